@@ -0,0 +1,675 @@
+#ifndef P2_CSECACHE_H
+#define P2_CSECACHE_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ModuleSlotTracker.h"
+#include "llvm/Linker/IRMover.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include "CSEPass.h"
+
+/* On-disk cache of optimized function bodies, for -cache-dir.
+ *
+ * The key of a function is the SHA1 of everything its optimization depends
+ * on:
+ * ■	its instructions before optimization: opcode, name, type, flags,
+ *	operands and whatever else makes two instructions different
+ *	(predicate, alignment, attributes, metadata...). Printing the function
+ *	would do, but takes longer than optimizing it.
+ * ■	the globals it references; for constant globals also the initializer,
+ *	since loads from it are folded, and the globals that refers to
+ * ■	the layouts of the structs it uses
+ * ■	the data layout, the target triple and the p2 options
+ * An entry holds the optimized body and how much each counter went up.
+ *
+ * The body is kept as function p2.cached of a bitcode module which declares
+ * every global it refers to as p2.ref.<name>. On a hit the module is linked
+ * in with an IRMover, which maps its types to the ones of the module, the
+ * declarations are replaced by the real globals and the blocks are moved
+ * into the function. -parallel sends the functions a worker thread
+ * optimized back to the main thread the same way.
+ *
+ * Entries are files named llvmcache-p2-<key>, so llvm::pruneCache keeps the
+ * directory under its size limit by removing the least recently used.
+ * Entries are written to p2-tmp-* files first, which prune() removes when
+ * they are left behind.
+ * */
+namespace p2 {
+
+class CSECache {
+public:
+    /* Changes whenever p2 may produce different code for the same input */
+    static constexpr const char *Version = "p2-cache-5";
+
+    unsigned Hits = 0;
+    unsigned Misses = 0;
+
+    CSECache(StringRef Dir, StringRef Options, Module &M)
+            : Dir(Dir), Options(Options), M(M), MST(&M) {}
+
+    std::string key(Function &F);
+    bool lookup(Function &F, StringRef Key, CSEStatistics &S);
+    void store(Function &F, StringRef Key, const CSEStatistics &S, ArrayRef<uint64_t> Before);
+
+    /* Counter values before a function is optimized, for store() */
+    static std::vector<uint64_t> snapshot(const CSEStatistics &S)
+    {
+        std::vector<uint64_t> Values;
+        for (CSECounter *C : S.Registered)
+            Values.push_back(C->getValue());
+        return Values;
+    }
+
+    /* Moving optimized bodies between modules, also used by -parallel: a
+     * fragment is a module with copies of functions, see copy_out() */
+    static bool portable(Function &F);
+    static bool copy_out(Function &F, Module &Frag, const Twine &Name);
+    static bool splice(Module &M, IRMover &Mover, std::unique_ptr<Module> Frag,
+                       ArrayRef<std::pair<std::string, Function *>> Bodies);
+
+    /* Remove the least recently used entries until Dir is at most MaxBytes,
+     * and the temporary files of store() a p2 that died left behind. A
+     * temporary file only lives while an entry is written, so one that has
+     * not changed for ten minutes is not written any more. */
+    static void prune(StringRef Dir, uint64_t MaxBytes)
+    {
+        std::error_code EC;
+        auto Stale = std::chrono::system_clock::now() - std::chrono::minutes(10);
+        for (sys::fs::directory_iterator I(Dir, EC), E; I != E && !EC; I.increment(EC)) {
+            if (!sys::path::filename(I->path()).startswith("p2-tmp-"))
+                continue;
+            sys::fs::file_status Status;
+            if (!sys::fs::status(I->path(), Status) && Status.getLastModificationTime() < Stale)
+                sys::fs::remove(I->path());
+        }
+
+        CachePruningPolicy Policy;
+        Policy.Interval = std::chrono::seconds(0);
+        Policy.Expiration = std::chrono::seconds(0);
+        Policy.MaxSizePercentageOfAvailableSpace = 0;
+        Policy.MaxSizeBytes = MaxBytes;
+        pruneCache(Dir, Policy);
+    }
+
+private:
+    std::string Dir;
+    std::string Options;
+    Module &M;
+    ModuleSlotTracker MST;
+    std::unique_ptr<IRMover> Mover;
+    /* SHA1 of the description of a global or a struct */
+    DenseMap<const GlobalValue *, std::string> GlobalDigests;
+    DenseMap<const Type *, std::string> TypeDigests;
+
+    std::string path(StringRef Key) const
+    {
+        SmallString<256> P(Dir);
+        sys::path::append(P, "llvmcache-p2-" + Key);
+        return std::string(P);
+    }
+
+    static std::string digest(StringRef Text)
+    {
+        return toHex(SHA1::hash(arrayRefFromStringRef(Text)));
+    }
+
+    static bool collect_constant(Constant *C, SetVector<GlobalValue *> &Refs,
+                                 SmallPtrSetImpl<Constant *> &Seen);
+    static bool collect_globals(Function &F, SetVector<GlobalValue *> &Refs);
+    const std::string &global_digest(GlobalValue *G);
+    const std::string &type_digest(Type *T);
+    bool encode(Function &F, raw_ostream &OS);
+};
+
+/* Add the globals C refers to. Fails on what cannot be named in another
+ * module: unnamed globals and block addresses. */
+inline bool CSECache::collect_constant(Constant *C, SetVector<GlobalValue *> &Refs,
+                                       SmallPtrSetImpl<Constant *> &Seen)
+{
+    if (!Seen.insert(C).second)
+        return true;
+    if (isa<BlockAddress>(C))
+        return false;
+    if (GlobalValue *G = dyn_cast<GlobalValue>(C)) {
+        if (!G->hasName())
+            return false;
+        Refs.insert(G);
+        return true;
+    }
+    for (Value *Op : C->operands()) {
+        if (!collect_constant(cast<Constant>(Op), Refs, Seen))
+            return false;
+    }
+    return true;
+}
+
+/* The globals F refers to directly */
+inline bool CSECache::collect_globals(Function &F, SetVector<GlobalValue *> &Refs)
+{
+    SmallPtrSet<Constant *, 32> Seen;
+    for (Value *Op : F.operands()) {
+        if (!collect_constant(cast<Constant>(Op), Refs, Seen))
+            return false;
+    }
+    for (BasicBlock &BB : F) {
+        for (Instruction &I : BB) {
+            for (Value *Op : I.operands()) {
+                Constant *C = dyn_cast<Constant>(Op);
+                if (C && !collect_constant(C, Refs, Seen))
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+inline const std::string &CSECache::global_digest(GlobalValue *G)
+{
+    std::string &D = GlobalDigests[G];
+    if (!D.empty())
+        return D;
+
+    std::string Text;
+    raw_string_ostream OS(Text);
+    OS << G->getName() << ' ' << (unsigned)G->getLinkage() << ' '
+       << *G->getValueType() << ' ' << G->getAddressSpace();
+    if (Function *Fn = dyn_cast<Function>(G)) {
+        OS << " function ";
+        Fn->getAttributes().print(OS);
+    } else if (GlobalVariable *GV = dyn_cast<GlobalVariable>(G)) {
+        OS << (GV->isConstant() ? " constant " : " global ");
+        if (GV->isConstant() && GV->hasDefinitiveInitializer())
+            GV->getInitializer()->print(OS, MST);
+    } else if (GlobalAlias *GA = dyn_cast<GlobalAlias>(G)) {
+        OS << " alias ";
+        GA->getAliasee()->print(OS, MST);
+    }
+    D = digest(OS.str());
+    return D;
+}
+
+/* Types are printed with the names of structs; add the layout of every
+ * struct that is part of T, except behind a pointer */
+inline const std::string &CSECache::type_digest(Type *T)
+{
+    std::string &D = TypeDigests[T];
+    if (!D.empty())
+        return D;
+
+    std::string Text;
+    raw_string_ostream OS(Text);
+    OS << *T;
+    SmallVector<Type *, 8> Work{T};
+    SmallPtrSet<Type *, 8> Seen;
+    while (!Work.empty()) {
+        Type *U = Work.pop_back_val();
+        if (!Seen.insert(U).second || U->isPointerTy())
+            continue;
+        StructType *ST = dyn_cast<StructType>(U);
+        if (ST && !ST->isLiteral()) {
+            OS << ' ' << ST->getName() << (ST->isPacked() ? " packed" : "")
+               << (ST->isOpaque() ? " opaque" : "") << " {";
+            for (Type *E : ST->elements())
+                OS << ' ' << *E;
+            OS << " }";
+        }
+        Work.append(U->subtype_begin(), U->subtype_end());
+    }
+    D = digest(OS.str());
+    return D;
+}
+
+/* Write everything the optimization of F sees in it to OS. Fails on
+ * operands that are not arguments, instructions, blocks, constants,
+ * metadata or inline asm. */
+inline bool CSECache::encode(Function &F, raw_ostream &OS)
+{
+    /* Arguments, blocks and instructions go by position. Constants,
+     * metadata and types are written out the first time and then referred
+     * to by number, which keeps the text to hash short. */
+    DenseMap<const Value *, unsigned> Local;
+    DenseMap<const Value *, unsigned> Printed;
+    DenseMap<Type *, unsigned> Types;
+    unsigned N = F.arg_size();
+    for (BasicBlock &BB : F)
+        N += 1 + BB.size();
+    Local.reserve(N);
+    for (Argument &A : F.args())
+        Local.insert({&A, Local.size()});
+    for (BasicBlock &BB : F) {
+        Local.insert({&BB, Local.size()});
+        for (Instruction &I : BB)
+            Local.insert({&I, Local.size()});
+    }
+    auto value = [&](Value *V) {
+        auto L = Local.find(V);
+        if (L != Local.end()) {
+            OS << " %" << L->second;
+            return true;
+        }
+        if (!isa<Constant>(V) && !isa<MetadataAsValue>(V) && !isa<InlineAsm>(V))
+            return false;
+        auto P = Printed.insert({V, Printed.size()});
+        OS << " c" << P.first->second;
+        if (P.second) {
+            OS << '=';
+            V->print(OS, MST);
+        }
+        return true;
+    };
+    auto type = [&](Type *T) -> raw_ostream & {
+        auto P = Types.insert({T, Types.size()});
+        OS << " t" << P.first->second;
+        if (P.second)
+            OS << '=' << type_digest(T);
+        return OS;
+    };
+
+    OS << F.getName();
+    type(F.getFunctionType()) << ' ' << F.getCallingConv()
+       << ' ' << (F.hasGC() ? F.getGC() : "") << ' ' << F.getSection() << '\n';
+    F.getAttributes().print(OS);
+    for (Value *Op : F.operands()) {
+        if (!value(Op))
+            return false;
+    }
+    for (Argument &A : F.args())
+        OS << A.getName() << '\n';
+
+    SmallVector<std::pair<unsigned, MDNode *>, 4> MDs;
+    for (BasicBlock &BB : F) {
+        OS << "block " << BB.getName() << '\n';
+        for (Instruction &I : BB) {
+            OS << I.getOpcode() << ' ' << I.getName();
+            type(I.getType()) << ' ' << I.getRawSubclassOptionalData();
+            for (Value *Op : I.operands()) {
+                if (!value(Op))
+                    return false;
+            }
+
+            /* What Instruction::isSameOperationAs compares besides the
+             * operands */
+            if (auto *AI = dyn_cast<AllocaInst>(&I))
+                type(AI->getAllocatedType()) << ' ' << AI->getAlign().value()
+                   << ' ' << AI->isUsedWithInAlloca() << AI->isSwiftError();
+            else if (auto *LI = dyn_cast<LoadInst>(&I))
+                OS << ' ' << LI->isVolatile() << ' ' << LI->getAlign().value() << ' '
+                   << (unsigned)LI->getOrdering() << ' ' << (unsigned)LI->getSyncScopeID();
+            else if (auto *SI = dyn_cast<StoreInst>(&I))
+                OS << ' ' << SI->isVolatile() << ' ' << SI->getAlign().value() << ' '
+                   << (unsigned)SI->getOrdering() << ' ' << (unsigned)SI->getSyncScopeID();
+            else if (auto *CI = dyn_cast<CmpInst>(&I))
+                OS << ' ' << CI->getPredicate();
+            else if (auto *GEP = dyn_cast<GetElementPtrInst>(&I))
+                type(GEP->getSourceElementType());
+            else if (auto *CB = dyn_cast<CallBase>(&I)) {
+                type(CB->getFunctionType()) << ' ' << CB->getCallingConv();
+                if (auto *CI = dyn_cast<CallInst>(&I))
+                    OS << ' ' << CI->getTailCallKind();
+                for (unsigned i = 0; i < CB->getNumOperandBundles(); i++)
+                    OS << ' ' << CB->getOperandBundleAt(i).getTagName();
+                OS << '\n';
+                CB->getAttributes().print(OS);
+            } else if (auto *PN = dyn_cast<PHINode>(&I)) {
+                for (BasicBlock *In : PN->blocks())
+                    value(In);
+            } else if (auto *SVI = dyn_cast<ShuffleVectorInst>(&I)) {
+                for (int Elt : SVI->getShuffleMask())
+                    OS << ' ' << Elt;
+            } else if (auto *EVI = dyn_cast<ExtractValueInst>(&I)) {
+                for (unsigned Idx : EVI->indices())
+                    OS << ' ' << Idx;
+            } else if (auto *IVI = dyn_cast<InsertValueInst>(&I)) {
+                for (unsigned Idx : IVI->indices())
+                    OS << ' ' << Idx;
+            } else if (auto *FI = dyn_cast<FenceInst>(&I))
+                OS << ' ' << (unsigned)FI->getOrdering() << ' ' << (unsigned)FI->getSyncScopeID();
+            else if (auto *CX = dyn_cast<AtomicCmpXchgInst>(&I))
+                OS << ' ' << CX->isVolatile() << CX->isWeak() << ' ' << CX->getAlign().value()
+                   << ' ' << (unsigned)CX->getSuccessOrdering() << ' '
+                   << (unsigned)CX->getFailureOrdering() << ' ' << (unsigned)CX->getSyncScopeID();
+            else if (auto *RMW = dyn_cast<AtomicRMWInst>(&I))
+                OS << ' ' << RMW->getOperation() << ' ' << RMW->isVolatile() << ' '
+                   << RMW->getAlign().value() << ' ' << (unsigned)RMW->getOrdering() << ' '
+                   << (unsigned)RMW->getSyncScopeID();
+            else if (auto *LP = dyn_cast<LandingPadInst>(&I)) {
+                OS << ' ' << LP->isCleanup();
+                for (unsigned i = 0; i < LP->getNumClauses(); i++)
+                    OS << ' ' << LP->isCatch(i);
+            }
+
+            I.getAllMetadata(MDs);
+            for (auto &MD : MDs) {
+                OS << " !" << MD.first;
+                value(MetadataAsValue::get(F.getContext(), MD.second));
+            }
+            OS << '\n';
+        }
+    }
+    return true;
+}
+
+/* Whether F can be copied to another module with copy_out(): not with debug
+ * info (its subprogram would be duplicated) or blocks whose address is
+ * taken. It must not refer to unnamed globals either, which copy_out()
+ * finds out. */
+inline bool CSECache::portable(Function &F)
+{
+    if (F.getSubprogram())
+        return false;
+    for (BasicBlock &BB : F) {
+        if (BB.hasAddressTaken())
+            return false;
+    }
+    return true;
+}
+
+/* Key of F as it is before optimization, or "" if F cannot be cached:
+ * functions that are not portable() or that refer to unnamed globals. */
+inline std::string CSECache::key(Function &F)
+{
+    if (!portable(F))
+        return "";
+
+    /* Everything reachable through the initializers of constant globals */
+    SetVector<GlobalValue *> Refs;
+    if (!collect_globals(F, Refs))
+        return "";
+    SmallPtrSet<Constant *, 32> Seen;
+    for (unsigned i = 0; i < Refs.size(); i++) {
+        GlobalVariable *GV = dyn_cast<GlobalVariable>(Refs[i]);
+        GlobalAlias *GA = dyn_cast<GlobalAlias>(Refs[i]);
+        if (GV && GV->isConstant() && GV->hasDefinitiveInitializer() &&
+            !collect_constant(GV->getInitializer(), Refs, Seen))
+            return "";
+        if (GA && !collect_constant(GA->getAliasee(), Refs, Seen))
+            return "";
+    }
+
+    std::string Text;
+    raw_string_ostream OS(Text);
+    OS << Version << '\n' << Options << '\n'
+       << M.getDataLayoutStr() << '\n' << M.getTargetTriple() << '\n';
+
+    if (!encode(F, OS))
+        return "";
+    for (GlobalValue *G : Refs)
+        OS << "global " << global_digest(G) << ' ' << type_digest(G->getValueType()) << '\n';
+
+    return digest(OS.str());
+}
+
+/* Give F its cached optimized body and add the counter increments to S.
+ * Returns false on a miss; F is then unchanged. */
+inline bool CSECache::lookup(Function &F, StringRef Key, CSEStatistics &S)
+{
+    std::string Path = path(Key);
+    Expected<sys::fs::file_t> FD = sys::fs::openNativeFileForRead(Path);
+    if (!FD) {
+        consumeError(FD.takeError());
+        Misses++;
+        return false;
+    }
+    /* Mark the entry as recently used for pruning */
+    sys::fs::setLastAccessAndModificationTime(*FD, std::chrono::system_clock::now());
+    ErrorOr<std::unique_ptr<MemoryBuffer>> Buf = MemoryBuffer::getOpenFile(*FD, Path, -1);
+    sys::fs::closeFile(*FD);
+    if (!Buf) {
+        Misses++;
+        return false;
+    }
+
+    /* "<Version> <N>" and N lines "<counter> <increment>", then bitcode */
+    StringRef Rest = (*Buf)->getBuffer();
+    StringRef Line;
+    std::tie(Line, Rest) = Rest.split('\n');
+    StringRef Tag, Count;
+    std::tie(Tag, Count) = Line.split(' ');
+    unsigned N;
+    if (Tag != Version || Count.getAsInteger(10, N)) {
+        Misses++;
+        return false;
+    }
+    std::vector<std::pair<CSECounter *, uint64_t>> Increments;
+    for (unsigned i = 0; i < N; i++) {
+        std::tie(Line, Rest) = Rest.split('\n');
+        StringRef Name, Value;
+        std::tie(Name, Value) = Line.split(' ');
+        CSECounter *C = S.lookup(Name);
+        uint64_t V;
+        if (!C || Value.getAsInteger(10, V)) {
+            Misses++;
+            return false;
+        }
+        Increments.push_back({C, V});
+    }
+
+    Expected<std::unique_ptr<Module>> Frag =
+            parseBitcodeFile(MemoryBufferRef(Rest, Path), M.getContext());
+    if (!Frag) {
+        consumeError(Frag.takeError());
+        Misses++;
+        return false;
+    }
+
+    if (!Mover)
+        Mover = std::make_unique<IRMover>(M);
+    if (!splice(M, *Mover, std::move(*Frag), {{"p2.cached", &F}})) {
+        Misses++;
+        return false;
+    }
+
+    for (auto &Inc : Increments)
+        *Inc.first += Inc.second;
+    Hits++;
+    return true;
+}
+
+/* Move Frag into M and give each function of Bodies the body of the
+ * function of Frag named with it. Fails when a name is taken in M, a
+ * declaration of Frag does not stand for a global of M or the types do not
+ * map to the ones of M; M is then as before. */
+inline bool CSECache::splice(Module &M, IRMover &Mover, std::unique_ptr<Module> Frag,
+                             ArrayRef<std::pair<std::string, Function *>> Bodies)
+{
+    /* The names the bodies and the declarations get in M must be free */
+    std::vector<GlobalValue *> Moved;
+    StringSet<> Names;
+    for (auto &B : Bodies) {
+        Function *Body = Frag->getFunction(B.first);
+        if (!Body || Body->isDeclaration() || M.getNamedValue(B.first))
+            return false;
+        Moved.push_back(Body);
+        Names.insert(B.first);
+    }
+    std::vector<std::pair<std::string, GlobalValue *>> Refs;
+    for (GlobalValue &G : Frag->global_values()) {
+        if (Names.count(G.getName()) || G.getName().startswith("llvm."))
+            continue;
+        GlobalValue *Real = nullptr;
+        if (G.getName().startswith("p2.ref."))
+            Real = M.getNamedValue(G.getName().drop_front(strlen("p2.ref.")));
+        if (!Real || M.getNamedValue(G.getName()))
+            return false;
+        Refs.push_back({std::string(G.getName()), Real});
+    }
+
+    if (Error E = Mover.move(std::move(Frag), Moved,
+                             [](GlobalValue &, IRMover::ValueAdder) {},
+                             /*IsPerformingImport=*/false)) {
+        consumeError(std::move(E));
+        return false;
+    }
+
+    /* Types are mapped to the ones of M; anything that did not map to the
+     * same type as what it stands for is not used */
+    bool Match = true;
+    for (auto &B : Bodies) {
+        Function *NewF = M.getFunction(B.first);
+        if (!NewF || NewF->getFunctionType() != B.second->getFunctionType())
+            Match = false;
+    }
+    for (auto &R : Refs) {
+        GlobalValue *D = M.getNamedValue(R.first);
+        if (D && D->getType() != R.second->getType())
+            Match = false;
+    }
+    if (!Match) {
+        for (auto &B : Bodies) {
+            if (Function *NewF = M.getFunction(B.first)) {
+                NewF->dropAllReferences();
+                NewF->eraseFromParent();
+            }
+        }
+        for (auto &R : Refs) {
+            GlobalValue *D = M.getNamedValue(R.first);
+            if (D && D->use_empty())
+                D->eraseFromParent();
+        }
+        return false;
+    }
+
+    for (auto &R : Refs) {
+        if (GlobalValue *D = M.getNamedValue(R.first)) {
+            D->replaceAllUsesWith(R.second);
+            D->eraseFromParent();
+        }
+    }
+    SmallVector<std::pair<unsigned, MDNode *>, 4> MDs;
+    for (auto &B : Bodies) {
+        Function &F = *B.second;
+        Function *NewF = M.getFunction(B.first);
+        /* A function of a lazily loaded M gets the body it would have
+         * loaded, and the attachments that come with it */
+        bool Lazy = F.isMaterializable();
+        F.setIsMaterializable(false);
+        for (BasicBlock &BB : F)
+            BB.dropAllReferences();
+        while (!F.empty())
+            F.begin()->eraseFromParent();
+        F.getBasicBlockList().splice(F.end(), NewF->getBasicBlockList());
+        for (unsigned i = 0; i < F.arg_size(); i++) {
+            if (Lazy)
+                F.getArg(i)->takeName(NewF->getArg(i));
+            NewF->getArg(i)->replaceAllUsesWith(F.getArg(i));
+        }
+        if (Lazy) {
+            NewF->getAllMetadata(MDs);
+            for (auto &MD : MDs)
+                F.setMetadata(MD.first, MD.second);
+        }
+        NewF->eraseFromParent();
+    }
+    return true;
+}
+
+/* Add a copy of F named Name to Frag, with a declaration p2.ref.<name> in
+ * place of every global it refers to. Fails if F refers to a global that
+ * cannot be named in another module. */
+inline bool CSECache::copy_out(Function &F, Module &Frag, const Twine &Name)
+{
+    SetVector<GlobalValue *> Refs;
+    if (!collect_globals(F, Refs))
+        return false;
+
+    Function *Copy = Function::Create(F.getFunctionType(), GlobalValue::InternalLinkage,
+                                      F.getAddressSpace(), Name, &Frag);
+    ValueToValueMapTy VMap;
+    for (unsigned i = 0; i < F.arg_size(); i++) {
+        VMap[F.getArg(i)] = Copy->getArg(i);
+        Copy->getArg(i)->setName(F.getArg(i)->getName());
+    }
+    for (GlobalValue *G : Refs) {
+        Function *Fn = dyn_cast<Function>(G);
+        if (Fn && Fn->isIntrinsic()) {
+            VMap[G] = Frag.getOrInsertFunction(Fn->getName(), Fn->getFunctionType(),
+                                               Fn->getAttributes()).getCallee();
+            continue;
+        }
+        /* Declared already for another function of Frag */
+        std::string RefName = ("p2.ref." + G->getName()).str();
+        if (GlobalValue *D = Frag.getNamedValue(RefName))
+            VMap[G] = D;
+        else if (FunctionType *FT = dyn_cast<FunctionType>(G->getValueType()))
+            VMap[G] = Function::Create(FT, GlobalValue::ExternalLinkage, G->getAddressSpace(), RefName, &Frag);
+        else
+            VMap[G] = new GlobalVariable(Frag, G->getValueType(), false, GlobalValue::ExternalLinkage,
+                                         nullptr, RefName, nullptr, G->getThreadLocalMode(),
+                                         G->getAddressSpace());
+    }
+    SmallVector<ReturnInst *, 8> Returns;
+    CloneFunctionInto(Copy, &F, VMap, CloneFunctionChangeType::DifferentModule, Returns);
+    /* Added for the compile units of the function, of which there are none */
+    if (NamedMDNode *CUs = Frag.getNamedMetadata("llvm.dbg.cu"))
+        Frag.eraseNamedMetadata(CUs);
+    return true;
+}
+
+/* Store the optimized F and the counters that went up since Before */
+inline void CSECache::store(Function &F, StringRef Key, const CSEStatistics &S, ArrayRef<uint64_t> Before)
+{
+    Module Frag("p2.cache", M.getContext());
+    Frag.setDataLayout(M.getDataLayout());
+    Frag.setTargetTriple(M.getTargetTriple());
+    if (!copy_out(F, Frag, "p2.cached"))
+        return;
+
+    std::string Entry;
+    raw_string_ostream OS(Entry);
+    std::vector<std::pair<const char *, uint64_t>> Increments;
+    for (unsigned i = 0; i < S.Registered.size(); i++) {
+        CSECounter *C = S.Registered[i];
+        uint64_t Prev = i < Before.size() ? Before[i] : 0;
+        if (C->getValue() != Prev)
+            Increments.push_back({C->getName(), C->getValue() - Prev});
+    }
+    OS << Version << ' ' << Increments.size() << '\n';
+    for (auto &Inc : Increments)
+        OS << Inc.first << ' ' << Inc.second << '\n';
+    WriteBitcodeToFile(Frag, OS);
+
+    /* Write to a temporary file and rename it, so that a concurrent p2 sees
+     * either the whole entry or none */
+    if (sys::fs::create_directories(Dir))
+        return;
+    int FD;
+    SmallString<256> Tmp;
+    if (sys::fs::createUniqueFile(Dir + "/p2-tmp-%%%%%%%%", FD, Tmp))
+        return;
+    {
+        raw_fd_ostream Out(FD, /*shouldClose=*/true);
+        Out << OS.str();
+        if (Out.has_error()) {
+            Out.clear_error();
+            sys::fs::remove(Tmp);
+            return;
+        }
+    }
+    if (sys::fs::rename(Tmp, path(Key)))
+        sys::fs::remove(Tmp);
+}
+
+} // namespace p2
+
+#endif // P2_CSECACHE_H
@@ -0,0 +1,95 @@
+#ifndef P2_CSEDOMINANCE_H
+#define P2_CSEDOMINANCE_H
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+
+/* Dominance information for one function, computed once and shared by every
+ * phase of the pass.
+ *
+ * Erasing or replacing instructions does not change the CFG, so the tree
+ * stays valid for as long as the pass works on the same function. A phase
+ * that edits the CFG must either update the tree (DominatorTree::applyUpdates)
+ * or call invalidate().
+ *
+ * The tree is either computed here or, when a pass manager already has one,
+ * borrowed from it with use().
+ *
+ * dominates() is O(1):
+ * ■	Same block: Instruction::comesBefore, which numbers the block once and
+ *	keeps the order cached until the block changes.
+ * ■	Different blocks: DFS in/out numbers of the tree nodes.
+ * */
+class CSEDominance {
+public:
+    CSEDominance() : Cur(&DT), Fn(nullptr), Valid(false), NumComputed(0) {}
+    CSEDominance(const CSEDominance &) = delete;
+    CSEDominance &operator=(const CSEDominance &) = delete;
+
+    /* The dominator tree of F, recomputed only if F is not the function the
+     * current tree was built for or the tree was invalidated. */
+    llvm::DominatorTree &get(llvm::Function &F)
+    {
+        if (Fn != &F || !Valid) {
+            DT.recalculate(F);
+            DT.updateDFSNumbers();
+            Cur = &DT;
+            Fn = &F;
+            Valid = true;
+            NumComputed++;
+        }
+        return *Cur;
+    }
+
+    /* Use Tree, which someone else computed and keeps alive, as the tree of
+     * F until F changes or the tree is invalidated. */
+    void use(llvm::Function &F, llvm::DominatorTree &Tree)
+    {
+        Tree.updateDFSNumbers();
+        Cur = &Tree;
+        Fn = &F;
+        Valid = true;
+    }
+
+    /* Does A strictly dominate B? Both must be in the current function. */
+    bool dominates(const llvm::Instruction *A, const llvm::Instruction *B) const
+    {
+        const llvm::BasicBlock *BA = A->getParent();
+        const llvm::BasicBlock *BB = B->getParent();
+        if (BA == BB)
+            return A != B && A->comesBefore(B);
+        return Cur->dominates(BA, BB);
+    }
+
+    bool dominates(const llvm::BasicBlock *A, const llvm::BasicBlock *B) const
+    {
+        return Cur->dominates(A, B);
+    }
+
+    void invalidate() { Valid = false; }
+
+    /* Free the tree. Done after every function when only one function is in
+     * memory at a time. */
+    void release()
+    {
+        DT.reset();
+        Cur = &DT;
+        Fn = nullptr;
+        Valid = false;
+    }
+
+    /* Number of full recomputations so far */
+    unsigned getNumComputed() const { return NumComputed; }
+
+private:
+    llvm::DominatorTree DT;
+    /* DT or a borrowed tree */
+    llvm::DominatorTree *Cur;
+    llvm::Function *Fn;
+    bool Valid;
+    unsigned NumComputed;
+};
+
+#endif // P2_CSEDOMINANCE_H
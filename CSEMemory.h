@@ -0,0 +1,132 @@
+#ifndef P2_CSEMEMORY_H
+#define P2_CSEMEMORY_H
+
+#include <memory>
+
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/BasicAliasAnalysis.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/ScopedNoAliasAA.h"
+#include "llvm/Analysis/TargetLibraryInfo.h"
+#include "llvm/Analysis/TypeBasedAliasAnalysis.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+
+/* Alias analysis, MemorySSA and the post-dominator tree for one function, for
+ * the phases that need to know which store or call may change or read a
+ * memory location.
+ *
+ * Alias analysis is BasicAA, TBAA and scoped noalias, the function local
+ * part of what opt uses by default. Like CSEDominance the analyses are either
+ * computed here or borrowed from a pass manager with use().
+ *
+ * MemorySSA is only kept up to date by the phase that uses it (through a
+ * MemorySSAUpdater). Everything else erases loads and stores without telling
+ * it, so the phase calls release() when it is done.
+ * */
+class CSEMemory {
+public:
+    CSEMemory() : Cur(nullptr), CurAA(nullptr), CurPDT(nullptr), Fn(nullptr) {}
+    CSEMemory(const CSEMemory &) = delete;
+    CSEMemory &operator=(const CSEMemory &) = delete;
+
+    /* MemorySSA of F, built on the dominator tree DT unless a borrowed one
+     * is in use */
+    llvm::MemorySSA &get(llvm::Function &F, llvm::DominatorTree &DT)
+    {
+        if (Fn == &F && Cur)
+            return *Cur;
+        release();
+
+        /* The library functions known to the target are the same for every
+         * function of a module */
+        llvm::Triple T(F.getParent()->getTargetTriple());
+        if (!TLII || TLIITriple != T) {
+            TLII = std::make_unique<llvm::TargetLibraryInfoImpl>(T);
+            TLIITriple = T;
+        }
+        TLI = std::make_unique<llvm::TargetLibraryInfo>(*TLII, &F);
+        AC = std::make_unique<llvm::AssumptionCache>(F);
+        BasicAA = std::make_unique<llvm::BasicAAResult>(F.getParent()->getDataLayout(), F, *TLI,
+                                                         *AC, &DT);
+        AA = std::make_unique<llvm::AAResults>(*TLI);
+        AA->addAAResult(*BasicAA);
+        AA->addAAResult(TBAA);
+        AA->addAAResult(ScopedAA);
+        MSSA = std::make_unique<llvm::MemorySSA>(F, AA.get(), &DT);
+
+        Cur = MSSA.get();
+        CurAA = AA.get();
+        CurPDT = nullptr;
+        Fn = &F;
+        return *Cur;
+    }
+
+    /* Use MemorySSA, alias analysis and the post-dominator tree that someone
+     * else computed for F and keeps alive */
+    void use(llvm::Function &F, llvm::MemorySSA &Borrowed, llvm::AAResults &BorrowedAA,
+             llvm::PostDominatorTree &BorrowedPDT)
+    {
+        release();
+        Cur = &Borrowed;
+        CurAA = &BorrowedAA;
+        CurPDT = &BorrowedPDT;
+        Fn = &F;
+    }
+
+    /* The alias analysis the current MemorySSA was built with */
+    llvm::AAResults &aa() const { return *CurAA; }
+
+    /* The post-dominator tree of the function of get(), computed the first
+     * time it is asked for */
+    llvm::PostDominatorTree &postdom()
+    {
+        if (!CurPDT) {
+            PDT.recalculate(*Fn);
+            CurPDT = &PDT;
+        }
+        return *CurPDT;
+    }
+
+    /* Forget the analyses of the current function */
+    void release()
+    {
+        /* MemorySSA refers to the alias analysis, which refers to the rest */
+        MSSA.reset();
+        AA.reset();
+        BasicAA.reset();
+        AC.reset();
+        TLI.reset();
+        PDT.reset();
+        Cur = nullptr;
+        CurAA = nullptr;
+        CurPDT = nullptr;
+        Fn = nullptr;
+    }
+
+    ~CSEMemory() { release(); }
+
+private:
+    llvm::Triple TLIITriple;
+    std::unique_ptr<llvm::TargetLibraryInfoImpl> TLII;
+    std::unique_ptr<llvm::TargetLibraryInfo> TLI;
+    std::unique_ptr<llvm::AssumptionCache> AC;
+    std::unique_ptr<llvm::BasicAAResult> BasicAA;
+    llvm::TypeBasedAAResult TBAA;
+    llvm::ScopedNoAliasAAResult ScopedAA;
+    std::unique_ptr<llvm::AAResults> AA;
+    std::unique_ptr<llvm::MemorySSA> MSSA;
+    llvm::PostDominatorTree PDT;
+
+    /* MSSA, AA and PDT, or borrowed ones */
+    llvm::MemorySSA *Cur;
+    llvm::AAResults *CurAA;
+    llvm::PostDominatorTree *CurPDT;
+    llvm::Function *Fn;
+};
+
+#endif // P2_CSEMEMORY_H
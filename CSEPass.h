@@ -0,0 +1,1625 @@
+#ifndef P2_CSEPASS_H
+#define P2_CSEPASS_H
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/ScopedHashTable.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Analysis/InstructionSimplify.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/MemorySSAUpdater.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/RecyclingAllocator.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "CSEDominance.h"
+#include "CSEMemory.h"
+
+/* Dead code elimination and CSE as run by p2, shared by the p2 tool and the
+ * pass plugin. Everything one run needs is in a CSEContext. */
+namespace p2 {
+using namespace llvm;
+
+class CSEContext;
+
+inline void CommonSubexpressionElimination(Function &F, CSEContext &Ctx);
+inline void RunDeadCodeElimination(Function &F, CSEContext &Ctx);
+inline bool isDead(Instruction &I);
+inline bool cse_check_opcode(Instruction &I);
+
+class CSEStatistics;
+
+/* A counter owned by one run of p2. Like llvm::Statistic it is registered
+ * the first time it is incremented, so the .stats file lists counters in the
+ * same order as before. */
+class CSECounter {
+public:
+    CSECounter(CSEStatistics &Owner, const char *Name, const char *Desc)
+            : Owner(Owner), Name(Name), Desc(Desc), Value(0), Registered(false), Traced(0) {}
+
+    CSECounter &operator++(int) { return *this += 1; }
+    CSECounter &operator+=(uint64_t V);
+
+    uint64_t getValue() const { return Value; }
+    const char *getName() const { return Name; }
+    const char *getDesc() const { return Desc; }
+
+private:
+    CSEStatistics &Owner;
+    const char *Name;
+    const char *Desc;
+    uint64_t Value;
+    bool Registered;
+    /* The trace of Owner this counter was last added to */
+    unsigned Traced;
+};
+
+class CSEStatistics {
+public:
+    CSECounter CSEDead{*this, "CSEDead", "CSE found dead instructions"};
+    CSECounter CSEElim{*this, "CSEElim", "CSE redundant instructions"};
+    CSECounter CSECallElim{*this, "CSECallElim", "CSE redundant calls"};
+    CSECounter CSESimplify{*this, "CSESimplify", "CSE simplified instructions"};
+    CSECounter CSELdElim{*this, "CSELdElim", "CSE redundant loads"};
+    CSECounter CSEStore2Load{*this, "CSEStore2Load", "CSE forwarded store to load"};
+    CSECounter CSEStElim{*this, "CSEStElim", "CSE redundant stores"};
+    CSECounter CSEHoist{*this, "CSEHoist", "CSE hoisted redundant instructions"};
+    CSECounter CSELICM{*this, "CSELICM", "CSE hoisted loop invariant instructions"};
+    CSECounter CSEOverBudget{*this, "CSEOverBudget", "CSE functions over budget"};
+
+    CSECounter nFunctions{*this, "Functions", "number of functions"};
+    CSECounter nInstructions{*this, "Instructions", "number of instructions"};
+    CSECounter nLoads{*this, "Loads", "number of loads"};
+    CSECounter nStores{*this, "Stores", "number of stores"};
+
+    /* Counters in the order they were first incremented */
+    std::vector<CSECounter *> Registered;
+
+    /* Append to Into the name of every counter incremented from now on,
+     * the first time it is. -parallel traces each phase of each function to
+     * register the counters of all shards in the order of a serial run. A
+     * null Into stops tracing. */
+    void trace(std::vector<const char *> *Into)
+    {
+        Trace = Into;
+        TraceNumber++;
+    }
+    std::vector<const char *> *Trace = nullptr;
+    unsigned TraceNumber = 0;
+
+    CSEStatistics() = default;
+    CSEStatistics(const CSEStatistics &) = delete;
+    CSEStatistics &operator=(const CSEStatistics &) = delete;
+
+    /* The counter called Name, or nullptr */
+    CSECounter *lookup(StringRef Name)
+    {
+        for (CSECounter *C : {&CSEDead, &CSEElim, &CSECallElim, &CSESimplify, &CSELdElim,
+                              &CSEStore2Load, &CSEStElim, &CSEHoist, &CSELICM, &CSEOverBudget,
+                              &nFunctions, &nInstructions, &nLoads, &nStores}) {
+            if (Name == C->getName())
+                return C;
+        }
+        return nullptr;
+    }
+
+    /* Add how much each counter of From went up since Before, the values of
+     * From.Registered at some earlier point (all of it without Before).
+     * Counters new here are registered in the order From registered them. */
+    void add(const CSEStatistics &From, ArrayRef<uint64_t> Before = None)
+    {
+        for (unsigned i = 0; i < From.Registered.size(); i++) {
+            CSECounter *C = From.Registered[i];
+            uint64_t Prev = i < Before.size() ? Before[i] : 0;
+            if (C->getValue() != Prev || i >= Before.size())
+                *lookup(C->getName()) += C->getValue() - Prev;
+        }
+    }
+
+    /* Same layout as llvm::PrintStatistics */
+    void print(raw_ostream &OS) const
+    {
+        std::vector<CSECounter *> Sorted(Registered);
+        std::sort(Sorted.begin(), Sorted.end(), [](CSECounter *L, CSECounter *R) {
+            return StringRef(L->getName()) < StringRef(R->getName());
+        });
+        unsigned MaxValLen = 0;
+        for (CSECounter *C : Sorted)
+            MaxValLen = std::max(MaxValLen, (unsigned)utostr(C->getValue()).size());
+
+        OS << "===" << std::string(73, '-') << "===\n"
+           << "                          ... Statistics Collected ...\n"
+           << "===" << std::string(73, '-') << "===\n\n";
+        for (CSECounter *C : Sorted)
+            OS << format("%*" PRIu64 "  - %s\n", MaxValLen, C->getValue(), C->getDesc());
+        OS << '\n';
+    }
+};
+
+inline CSECounter &CSECounter::operator+=(uint64_t V)
+{
+    if (!Registered) {
+        Owner.Registered.push_back(this);
+        Registered = true;
+    }
+    if (Owner.Trace && Traced != Owner.TraceNumber) {
+        Owner.Trace->push_back(Name);
+        Traced = Owner.TraceNumber;
+    }
+    Value += V;
+    return *this;
+}
+
+/* Instructions that have to be looked at again because one of their operands
+ * was replaced or one of their users was erased. Erased instructions are
+ * taken off the list in O(1). */
+class CSEWorklist {
+public:
+    bool empty() const { return Index.empty(); }
+
+    void push(Instruction *I)
+    {
+        if (Index.insert({I, (unsigned)List.size()}).second)
+            List.push_back(I);
+    }
+
+    Instruction *pop()
+    {
+        while (!List.empty()) {
+            Instruction *I = List.back();
+            List.pop_back();
+            if (I) {
+                Index.erase(I);
+                return I;
+            }
+        }
+        return nullptr;
+    }
+
+    void remove(Instruction *I)
+    {
+        auto It = Index.find(I);
+        if (It != Index.end()) {
+            List[It->second] = nullptr;
+            Index.erase(It);
+        }
+    }
+
+    void clear()
+    {
+        List.clear();
+        Index.clear();
+    }
+
+private:
+    std::vector<Instruction *> List;
+    DenseMap<Instruction *, unsigned> Index;
+};
+
+/* Where the time of one function went, for -json-stats. Times are wall
+ * seconds; the phases do not overlap. */
+struct CSEFunctionProfile {
+    std::string Name;
+    unsigned InstructionsBefore = 0;
+    unsigned InstructionsAfter = 0;
+    double DCE = 0;
+    double DomTree = 0;
+    double Memory = 0;
+    double ValueNumbering = 0;
+    double Hoist = 0;
+    double Fixpoint = 0;
+    uint64_t WorklistItems = 0;
+    /* Peak RSS of the process after the function, and how much the function
+     * raised it */
+    uint64_t PeakRSSKB = 0;
+    uint64_t PeakRSSGrowthKB = 0;
+};
+
+class CSEProfile {
+public:
+    bool Enabled = false;
+    std::vector<CSEFunctionProfile> Functions;
+
+    /* Profile of F, or nullptr when not profiling */
+    CSEFunctionProfile *get(Function &F)
+    {
+        if (!Enabled)
+            return nullptr;
+        auto It = Index.insert({&F, (unsigned)Functions.size()});
+        if (It.second) {
+            Functions.emplace_back();
+            Functions.back().Name = std::string(F.getName());
+        }
+        return &Functions[It.first->second];
+    }
+
+private:
+    DenseMap<Function *, unsigned> Index;
+};
+
+/* How much work p2 may spend on one function. Every phase counts the
+ * instructions it visits with step(), and stops at the next instruction
+ * once the function is over budget. The phases left are skipped, so the
+ * function keeps what was done so far; every change is complete when it is
+ * made, so the function is valid. The instructions and the time of DCE and
+ * CSE on the same function add up. A limit of 0 is no limit.
+ * */
+class CSEBudget {
+public:
+    uint64_t MaxSteps = 0;
+    unsigned MaxMilliseconds = 0;
+
+    explicit CSEBudget(CSECounter &OverBudget) : OverBudget(OverBudget) {}
+
+    /* Start or continue the work on F */
+    void begin(const Function &F)
+    {
+        Cur = &Used[&F];
+        Start = std::chrono::steady_clock::now();
+    }
+
+    void end()
+    {
+        if (Cur)
+            Cur->Seconds += elapsed();
+        Cur = nullptr;
+    }
+
+    /* Count one instruction visited. False once the function is over
+     * budget. The clock is only read every 256 steps. */
+    bool step()
+    {
+        if (!Cur)
+            return true;
+        if (Cur->Exhausted)
+            return false;
+        Cur->Steps++;
+        if ((MaxSteps && Cur->Steps > MaxSteps) ||
+            (MaxMilliseconds && (Cur->Steps & 255) == 0 &&
+             (Cur->Seconds + elapsed()) * 1000 > MaxMilliseconds)) {
+            Cur->Exhausted = true;
+            OverBudget++;
+        }
+        return !Cur->Exhausted;
+    }
+
+    bool exhausted() const { return Cur && Cur->Exhausted; }
+
+    bool exhausted(const Function &F) const
+    {
+        auto It = Used.find(&F);
+        return It != Used.end() && It->second.Exhausted;
+    }
+
+private:
+    struct Usage {
+        uint64_t Steps = 0;
+        double Seconds = 0;
+        bool Exhausted = false;
+    };
+
+    double elapsed() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+    }
+
+    CSECounter &OverBudget;
+    DenseMap<const Function *, Usage> Used;
+    /* The entry of the function being worked on */
+    Usage *Cur = nullptr;
+    std::chrono::steady_clock::time_point Start;
+};
+
+/* Makes its scope count against the budget of F */
+class CSEBudgetScope {
+public:
+    CSEBudgetScope(CSEBudget &B, const Function &F) : B(B) { B.begin(F); }
+    ~CSEBudgetScope() { B.end(); }
+
+private:
+    CSEBudget &B;
+};
+
+/* Optimization remarks for every change p2 makes, for p2 -remarks and opt
+ * -pass-remarks-output. A remark is named after the counter of the change
+ * and gives the function, the block and debug location of the instruction
+ * and the value that replaced it. It goes to the remark streamer of the
+ * LLVMContext, which writes it out right away, so nothing accumulates. With
+ * remarks off, a change costs one test of Enabled; built with
+ * P2_NO_REMARKS, not even that (see tests/bench/remarks.sh).
+ * */
+class CSERemarks {
+public:
+    bool Enabled = false;
+
+    /* V as the argument Key of a remark. As ore::NV, but instructions are
+     * given by name as well as opcode, and blocks as by block(). */
+    DiagnosticInfoOptimizationBase::Argument value(StringRef Key, const Value *V)
+    {
+        DiagnosticInfoOptimizationBase::Argument A(Key, V);
+        if (const BasicBlock *BB = dyn_cast<BasicBlock>(V))
+            A.Val = block(BB);
+        else if (isa<Instruction>(V) && V->hasName())
+            A.Val = ("%" + V->getName() + " = " + cast<Instruction>(V)->getOpcodeName()).str();
+        return A;
+    }
+
+    /* The name of BB, or #<n> for the n-th block of its function if it has
+     * none. No phase adds or removes blocks, so the blocks of a function are
+     * numbered once. */
+    std::string block(const BasicBlock *BB)
+    {
+        if (BB->hasName())
+            return BB->getName().str();
+        if (BB->getParent() != Numbered || !Numbers.count(BB)) {
+            Numbers.clear();
+            unsigned n = 0;
+            for (const BasicBlock &B : *BB->getParent())
+                Numbers[&B] = n++;
+            Numbered = BB->getParent();
+        }
+        return "#" + utostr(Numbers.lookup(BB));
+    }
+
+private:
+    const Function *Numbered = nullptr;
+    DenseMap<const BasicBlock *, unsigned> Numbers;
+};
+
+/* The functions, instructions, loads and stores of the module as p2 leaves
+ * it, for .stats. DCE counts a function while it queues its instructions and
+ * cse_erase takes erased instructions off, so the module does not have to be
+ * walked again. Only complete when DCE saw every function first, as in p2. */
+struct CSESummary {
+    uint64_t Functions = 0;
+    uint64_t Instructions = 0;
+    uint64_t Loads = 0;
+    uint64_t Stores = 0;
+
+    void add(const Instruction &I)
+    {
+        Instructions++;
+        Loads += isa<LoadInst>(I);
+        Stores += isa<StoreInst>(I);
+    }
+
+    void remove(const Instruction &I)
+    {
+        Instructions--;
+        Loads -= isa<LoadInst>(I);
+        Stores -= isa<StoreInst>(I);
+    }
+
+    /* A function DCE did not see */
+    void add(const Function &F)
+    {
+        if (F.empty())
+            return;
+        Functions++;
+        for (const BasicBlock &BB : F) {
+            for (const Instruction &I : BB)
+                add(I);
+        }
+    }
+
+    /* Add how much From went up since Before */
+    void add(const CSESummary &From, const CSESummary &Before)
+    {
+        Functions += From.Functions - Before.Functions;
+        Instructions += From.Instructions - Before.Instructions;
+        Loads += From.Loads - Before.Loads;
+        Stores += From.Stores - Before.Stores;
+    }
+};
+
+/* Everything one run of p2 over one module needs. Nothing is shared between
+ * runs, so modules in their own LLVMContext can be optimized concurrently. */
+class CSEContext {
+public:
+    CSEStatistics Stats;
+    CSEDominance Dom;
+    CSEMemory Memory;
+    CSEProfile Profile;
+    CSEBudget Budget{Stats.CSEOverBudget};
+    CSERemarks Remarks;
+    CSESummary Summary;
+    /* The functions changed so far. Only these need to be verified. */
+    SmallPtrSet<const Function *, 16> Changed;
+
+    /* Follow up every change until nothing changes any more */
+    bool Fixpoint = true;
+    /* Eliminate redundant loads across blocks with MemorySSA */
+    bool GlobalLoads = false;
+    /* Eliminate stores overwritten in a post-dominating block */
+    bool GlobalStores = false;
+    /* Move expressions computed in every successor of a branch above it */
+    bool Hoist = false;
+    /* Move loop invariant expressions into the loop preheader */
+    bool LICM = false;
+
+    /* Changes not yet followed up, for the function being optimized */
+    CSEWorklist Worklist;
+    SmallSetVector<BasicBlock *, 8> DirtyBlocks;
+};
+
+/* Peak resident set size of the process so far */
+inline uint64_t peak_rss_kb()
+{
+    struct rusage RU;
+    if (getrusage(RUSAGE_SELF, &RU) != 0)
+        return 0;
+    return RU.ru_maxrss;
+}
+
+/* Adds the wall time of its scope to one phase of a function profile. Like
+ * TimeRegion it does nothing when there is no profile. */
+class CSEProfileRegion {
+public:
+    CSEProfileRegion(CSEFunctionProfile *P, double CSEFunctionProfile::*Phase)
+            : P(P), Phase(Phase)
+    {
+        if (P) {
+            StartRSS = peak_rss_kb();
+            Start = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~CSEProfileRegion()
+    {
+        if (!P)
+            return;
+        P->*Phase += std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+        P->PeakRSSKB = peak_rss_kb();
+        P->PeakRSSGrowthKB += P->PeakRSSKB - StartRSS;
+    }
+
+private:
+    CSEFunctionProfile *P;
+    double CSEFunctionProfile::*Phase;
+    uint64_t StartRSS = 0;
+    std::chrono::steady_clock::time_point Start;
+};
+
+/* The remark for a change counted in Kind: I, still in place, is What, by
+ * or to V if given */
+LLVM_ATTRIBUTE_NOINLINE inline void cse_emit_remark(CSEContext &Ctx, const CSECounter &Kind, Instruction *I,
+                                                    StringRef What, Value *V)
+{
+    OptimizationRemark R("p2", Kind.getName(), I);
+    R << Ctx.Remarks.value("Inst", I) << " in " << Ctx.Remarks.value("Block", I->getParent());
+    if (V)
+        R << (" " + What + " ").str() << Ctx.Remarks.value(isa<BasicBlock>(V) ? "To" : "With", V);
+    else
+        R << (" " + What).str();
+    I->getContext().diagnose(R);
+}
+
+inline void cse_remark(CSEContext &Ctx, const CSECounter &Kind, Instruction *I, StringRef What,
+                       Value *V = nullptr)
+{
+#ifndef P2_NO_REMARKS
+    if (LLVM_UNLIKELY(Ctx.Remarks.Enabled))
+        cse_emit_remark(Ctx, Kind, I, What, V);
+#else
+    (void)Ctx, (void)Kind, (void)I, (void)What, (void)V;
+#endif
+}
+
+/* Erase I. Its operands may have lost their last use, so they are queued. */
+inline void cse_erase(Instruction *I, CSEContext &Ctx)
+{
+    for (Value *Op : I->operands()) {
+        if (Instruction *OpI = dyn_cast<Instruction>(Op))
+            Ctx.Worklist.push(OpI);
+    }
+    Ctx.Worklist.remove(I);
+    Ctx.Summary.remove(*I);
+    Ctx.Changed.insert(I->getFunction());
+    I->eraseFromParent();
+}
+
+/* Replace every use of I by V and erase I. The users now see a new operand
+ * and may simplify or match another expression, so they are queued. */
+inline void cse_replace(Instruction *I, Value *V, CSEContext &Ctx)
+{
+    for (User *U : I->users()) {
+        Instruction *UI = cast<Instruction>(U);
+        Ctx.Worklist.push(UI);
+        /* A load or store with a new pointer or value can match other
+         * memory operations of its block */
+        if (isa<LoadInst>(UI) || isa<StoreInst>(UI))
+            Ctx.DirtyBlocks.insert(UI->getParent());
+    }
+    I->replaceAllUsesWith(V);
+    cse_erase(I, Ctx);
+}
+
+/* cse_erase and cse_replace of a change counted in Kind */
+inline void cse_erase(Instruction *I, CSECounter &Kind, CSEContext &Ctx)
+{
+    Kind++;
+    cse_remark(Ctx, Kind, I, "erased");
+    cse_erase(I, Ctx);
+}
+
+inline void cse_replace(Instruction *I, Value *V, CSECounter &Kind, CSEContext &Ctx)
+{
+    Kind++;
+    cse_remark(Ctx, Kind, I, "replaced by", V);
+    cse_replace(I, V, Ctx);
+}
+
+/* Erase I if it is dead, or replace it if SimplifyInstruction folds it.
+ * Returns true if I is gone. */
+inline bool cse_dead_or_simplify(Instruction *I, const DataLayout &DL, CSEContext &Ctx)
+{
+    CSEStatistics &S = Ctx.Stats;
+    if (isDead(*I)) {
+        /* The stores before a dead load may now be overwritten without
+         * being read */
+        if (isa<LoadInst>(I))
+            Ctx.DirtyBlocks.insert(I->getParent());
+        // remove it!
+        cse_erase(I, S.CSEDead, Ctx);
+        return true;
+    }
+    if (Value *V = SimplifyInstruction(I, {DL})) {
+        cse_replace(I, V, S.CSESimplify, Ctx);
+        return true;
+    }
+    return false;
+}
+
+/* Value numbering table for CSE. Two instructions get the same value number
+ * when they have the same opcode, the same type and the same operands in the
+ * same order, up to canonicalization:
+ * ■	the operands of a commutative operation may be swapped
+ * ■	a compare with swapped operands and swapped predicate (a < b, b > a)
+ * The predicate of a compare, the source element type of a GEP and the mask
+ * of a shufflevector (it is not an operand) have to match as well, and for
+ * calls (the callee is an operand) the function type, calling convention
+ * and attributes. The table is scoped: a scope is opened for every node of the
+ * dominator tree and closed when its subtree is done, so an entry is visible
+ * exactly in the blocks that the defining instruction dominates.
+ * */
+struct CSEExpr {
+    Instruction *Inst;
+
+    CSEExpr(Instruction *I) : Inst(I) {}
+};
+
+} // namespace p2
+
+namespace llvm {
+template <> struct DenseMapInfo<p2::CSEExpr> {
+    static inline p2::CSEExpr getEmptyKey() {
+        return DenseMapInfo<Instruction *>::getEmptyKey();
+    }
+
+    static inline p2::CSEExpr getTombstoneKey() {
+        return DenseMapInfo<Instruction *>::getTombstoneKey();
+    }
+
+    static unsigned getHashValue(p2::CSEExpr E) {
+        Instruction *I = E.Inst;
+        /* Hash the canonical form: commutative operands and the operands of
+         * a compare in pointer order, the predicate swapped with them */
+        if (I->isCommutative() && I->getNumOperands() == 2) {
+            Value *L = I->getOperand(0);
+            Value *R = I->getOperand(1);
+            if (R < L)
+                std::swap(L, R);
+            return hash_combine(I->getOpcode(), I->getType(), L, R);
+        }
+        if (CmpInst *C = dyn_cast<CmpInst>(I)) {
+            Value *L = C->getOperand(0);
+            Value *R = C->getOperand(1);
+            CmpInst::Predicate Pred = C->getPredicate();
+            if (R < L) {
+                std::swap(L, R);
+                Pred = C->getSwappedPredicate();
+            }
+            return hash_combine(I->getOpcode(), I->getType(), Pred, L, R);
+        }
+        if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(I))
+            return hash_combine(I->getOpcode(), I->getType(), GEP->getSourceElementType(),
+                                hash_combine_range(I->value_op_begin(), I->value_op_end()));
+        if (ShuffleVectorInst *SV = dyn_cast<ShuffleVectorInst>(I)) {
+            ArrayRef<int> Mask = SV->getShuffleMask();
+            return hash_combine(I->getOpcode(), I->getType(), hash_combine_range(Mask.begin(), Mask.end()),
+                                hash_combine_range(I->value_op_begin(), I->value_op_end()));
+        }
+        return hash_combine(I->getOpcode(), I->getType(),
+                            hash_combine_range(I->value_op_begin(), I->value_op_end()));
+    }
+
+    static bool isEqual(p2::CSEExpr LHS, p2::CSEExpr RHS) {
+        Instruction *i = LHS.Inst;
+        Instruction *j = RHS.Inst;
+        if (i == j || i == getEmptyKey().Inst || i == getTombstoneKey().Inst ||
+            j == getEmptyKey().Inst || j == getTombstoneKey().Inst)
+            return i == j;
+        /* Checks for
+         * ■	Same opcode
+         * ■	Same type (LLVMTypeOf of the instruction not its operands)
+         * ■	Same number of operands
+         * ■	Same operands in the same order, or swapped for a commutative
+         *	operation or a compare with the swapped predicate
+         * ■	Same predicate, GEP source element type or shuffle mask
+         * */
+        if ((i->getOpcode() != j->getOpcode()) ||
+            (i->getType() != j->getType()) ||
+            (i->getNumOperands() != j->getNumOperands()))
+            return false;
+        if (CmpInst *ci = dyn_cast<CmpInst>(i)) {
+            CmpInst *cj = cast<CmpInst>(j);
+            if (ci->getPredicate() == cj->getPredicate() &&
+                ci->getOperand(0) == cj->getOperand(0) && ci->getOperand(1) == cj->getOperand(1))
+                return true;
+            return ci->getSwappedPredicate() == cj->getPredicate() &&
+                   ci->getOperand(0) == cj->getOperand(1) && ci->getOperand(1) == cj->getOperand(0);
+        }
+        if (i->isCommutative() && i->getNumOperands() == 2 &&
+            i->getOperand(0) == j->getOperand(1) && i->getOperand(1) == j->getOperand(0))
+            return true;
+        if (isa<GetElementPtrInst>(i) &&
+            cast<GetElementPtrInst>(i)->getSourceElementType() !=
+                    cast<GetElementPtrInst>(j)->getSourceElementType())
+            return false;
+        if (isa<ShuffleVectorInst>(i) &&
+            cast<ShuffleVectorInst>(i)->getShuffleMask() != cast<ShuffleVectorInst>(j)->getShuffleMask())
+            return false;
+        if (CallInst *ci = dyn_cast<CallInst>(i)) {
+            CallInst *cj = cast<CallInst>(j);
+            if (ci->getFunctionType() != cj->getFunctionType() ||
+                ci->getCallingConv() != cj->getCallingConv() ||
+                ci->getAttributes() != cj->getAttributes())
+                return false;
+        }
+        for (unsigned w = 0; w < i->getNumOperands(); w++) {
+            if (i->getOperand(w) != j->getOperand(w))
+                return false;
+        }
+        return true;
+    }
+};
+} // namespace llvm
+
+namespace p2 {
+
+typedef RecyclingAllocator<BumpPtrAllocator, ScopedHashTableVal<CSEExpr, Instruction *>> CSEAllocator;
+typedef ScopedHashTable<CSEExpr, Instruction *, DenseMapInfo<CSEExpr>, CSEAllocator> CSEExprTable;
+typedef ScopedHashTableScope<CSEExpr, Instruction *, DenseMapInfo<CSEExpr>, CSEAllocator> CSEExprScope;
+
+/* Memory values available at the current point of the walk. The dominator
+ * tree is walked in preorder and each block is swept once in program order:
+ * ■	AvailMem maps a pointer to the load or store that last produced the
+ *	value at that address. Anything that may write memory starts a new
+ *	generation, which invalidates every entry in O(1). The table is
+ *	scoped like the one of value numbering, so the entries of a block are
+ *	seen in the blocks it dominates. A block with more than one
+ *	predecessor starts a new generation: memory may have changed on
+ *	another path into it.
+ * ■	PendingStores maps a pointer to the last store to it that nothing has
+ *	read since. Anything that may read memory starts a new read generation.
+ *	A store is only removed by a later store of the same block, and not
+ *	across anything that may throw: the caller would see what it wrote.
+ * ■	AvailCalls holds the calls that only read memory, by expression. A
+ *	call is merged with an earlier one of the same generation.
+ * A stored value is only forwarded to a load with no other memory access
+ * in between, also when the load is in a dominated block.
+ * */
+struct CSEMemValue {
+    Instruction *Inst;
+    unsigned Generation;
+    unsigned ReadGeneration;
+};
+
+typedef RecyclingAllocator<BumpPtrAllocator, ScopedHashTableVal<Value *, CSEMemValue>> CSEMemAllocator;
+typedef ScopedHashTable<Value *, CSEMemValue, DenseMapInfo<Value *>, CSEMemAllocator> CSEMemTable;
+typedef ScopedHashTableScope<Value *, CSEMemValue, DenseMapInfo<Value *>, CSEMemAllocator> CSEMemScope;
+typedef RecyclingAllocator<BumpPtrAllocator, ScopedHashTableVal<CSEExpr, CSEMemValue>> CSECallAllocator;
+typedef ScopedHashTable<CSEExpr, CSEMemValue, DenseMapInfo<CSEExpr>, CSECallAllocator> CSECallTable;
+typedef ScopedHashTableScope<CSEExpr, CSEMemValue, DenseMapInfo<CSEExpr>, CSECallAllocator> CSECallScope;
+
+/* Can the call be merged with an identical one? Calls that do not touch
+ * memory always, calls that only read it while memory is unchanged. If the
+ * first one returned, so does the second one, with the same result. */
+inline bool cse_pure_call(Instruction &I)
+{
+    CallInst *CI = dyn_cast<CallInst>(&I);
+    return CI && CI->onlyReadsMemory() && !CI->getType()->isVoidTy() && !CI->isConvergent() &&
+           !CI->hasOperandBundles() && !CI->isInlineAsm() && !CI->isMustTailCall() &&
+           !CI->hasFnAttr(Attribute::ReturnsTwice);
+}
+
+struct CSEMemState {
+    CSEMemTable AvailMem;
+    CSECallTable AvailCalls;
+    unsigned Generation = 0;
+    unsigned ReadGeneration = 0;
+    /* Generations are never reused, so an entry is only current in the
+     * generation it was made in */
+    unsigned LastGeneration = 0;
+
+    void write() { Generation = ++LastGeneration; }
+    void read() { ReadGeneration = ++LastGeneration; }
+};
+
+inline void cse_memory_block(BasicBlock *BB, CSEMemState &State, CSEContext &Ctx)
+{
+    CSEStatistics &S = Ctx.Stats;
+    CSEMemTable &AvailMem = State.AvailMem;
+    DenseMap<Value *, CSEMemValue> PendingStores;
+
+    for (auto i = BB->begin(); i != BB->end();) {
+        Instruction *I = &*i++;
+        if (!Ctx.Budget.step())
+            return;
+
+        if (LoadInst *LI = dyn_cast<LoadInst>(I)) {
+            if (LI->isSimple()) {
+                Value *Ptr = LI->getPointerOperand();
+
+                CSEMemValue A = AvailMem.lookup(Ptr);
+                if (A.Inst && A.Generation == State.Generation) {
+                    if (isa<LoadInst>(A.Inst) && A.Inst->getType() == LI->getType()) {
+                        cse_replace(LI, A.Inst, S.CSELdElim, Ctx);
+                        continue;
+                    }
+                    StoreInst *SI = dyn_cast<StoreInst>(A.Inst);
+                    if (SI && SI->getValueOperand()->getType() == LI->getType() &&
+                        A.ReadGeneration == State.ReadGeneration) {
+                        cse_replace(LI, SI->getValueOperand(), S.CSEStore2Load, Ctx);
+                        continue;
+                    }
+                }
+                State.read();
+                AvailMem.insert(Ptr, {LI, State.Generation, State.ReadGeneration});
+                continue;
+            }
+        } else if (cse_pure_call(*I) && !cast<CallInst>(I)->doesNotAccessMemory()) {
+            CSEMemValue A = State.AvailCalls.lookup(I);
+            if (A.Inst && A.Generation == State.Generation) {
+                A.Inst->andIRFlags(I);
+                cse_replace(I, A.Inst, S.CSECallElim, Ctx);
+                continue;
+            }
+            State.AvailCalls.insert(I, {I, State.Generation, State.ReadGeneration});
+        } else if (StoreInst *SI = dyn_cast<StoreInst>(I)) {
+            if (SI->isSimple()) {
+                Value *Ptr = SI->getPointerOperand();
+
+                /* The earlier store is overwritten before anything reads it */
+                auto P = PendingStores.find(Ptr);
+                if (P != PendingStores.end() && P->second.ReadGeneration == State.ReadGeneration) {
+                    StoreInst *Prev = cast<StoreInst>(P->second.Inst);
+                    if (Prev->getValueOperand()->getType() == SI->getValueOperand()->getType()) {
+                        cse_erase(Prev, S.CSEStElim, Ctx);
+                    }
+                }
+
+                /* Without alias information any other address may change */
+                State.write();
+                AvailMem.insert(Ptr, {SI, State.Generation, State.ReadGeneration});
+                PendingStores[Ptr] = {SI, State.Generation, State.ReadGeneration};
+                continue;
+            }
+        }
+
+        if (I->mayReadFromMemory())
+            State.read();
+        if (I->mayWriteToMemory())
+            State.write();
+        if (I->mayThrow())
+            PendingStores.clear();
+    }
+
+    /* Loads and stores of this block changed by the sweep itself were seen */
+    Ctx.DirtyBlocks.remove(BB);
+}
+
+/* Sweep one block again, with nothing known about memory at its start */
+inline void cse_memory_block(BasicBlock *BB, CSEContext &Ctx)
+{
+    CSEMemState State;
+    CSEMemScope Scope(State.AvailMem);
+    CSECallScope CallScope(State.AvailCalls);
+    cse_memory_block(BB, State, Ctx);
+}
+
+/* One entry of the preorder walk of the memory sweep. The generations are
+ * those at the end of the block, where its children start. */
+struct CSEMemStackNode {
+    CSEMemScope Scope;
+    CSECallScope CallScope;
+    DomTreeNode *Node;
+    DomTreeNode::const_iterator NextChild;
+    unsigned Generation;
+    unsigned ReadGeneration;
+    bool Processed;
+
+    CSEMemStackNode(CSEMemState &State, DomTreeNode *N, unsigned Generation, unsigned ReadGeneration)
+            : Scope(State.AvailMem), CallScope(State.AvailCalls), Node(N), NextChild(N->begin()), Generation(Generation),
+              ReadGeneration(ReadGeneration), Processed(false) {}
+};
+
+inline void cse_memory(Function &F, DominatorTree &DT, CSEContext &Ctx)
+{
+    CSEMemState State;
+    std::vector<std::unique_ptr<CSEMemStackNode>> Stack;
+    Stack.push_back(std::make_unique<CSEMemStackNode>(State, DT.getRootNode(), 0, 0));
+    while (!Stack.empty()) {
+        CSEMemStackNode *Top = Stack.back().get();
+        if (!Top->Processed) {
+            BasicBlock *BB = Top->Node->getBlock();
+            State.Generation = Top->Generation;
+            State.ReadGeneration = Top->ReadGeneration;
+            /* Memory may be written or read on another path into BB */
+            if (!BB->getSinglePredecessor()) {
+                State.write();
+                State.read();
+            }
+            cse_memory_block(BB, State, Ctx);
+            Top->Generation = State.Generation;
+            Top->ReadGeneration = State.ReadGeneration;
+            Top->Processed = true;
+        }
+        if (Top->NextChild != Top->Node->end()) {
+            DomTreeNode *Child = *Top->NextChild++;
+            Stack.push_back(std::make_unique<CSEMemStackNode>(State, Child, Top->Generation,
+                                                              Top->ReadGeneration));
+        } else {
+            Stack.pop_back();
+        }
+    }
+
+    /* Blocks the walk does not reach */
+    for (BasicBlock &BB : F) {
+        if (!DT.isReachableFromEntry(&BB))
+            cse_memory_block(&BB, Ctx);
+    }
+}
+
+/* Redundant loads across the whole function. A load is redundant when
+ * ■	the access that last may have changed its memory (its clobber in
+ *	MemorySSA) is a store to the same address of a value of its type:
+ *	the stored value is forwarded, or
+ * ■	a load of the same pointer with the same clobber dominates it: no
+ *	write that may alias lies between the two on any path.
+ * The dominator tree is walked in preorder, so the dominating load is seen
+ * first. Loads are the only thing erased, which does not change the clobber
+ * of any other load.
+ * */
+inline void cse_global_loads(Function &F, CSEContext &Ctx)
+{
+    CSEStatistics &S = Ctx.Stats;
+    DominatorTree &DT = Ctx.Dom.get(F);
+    MemorySSA &MSSA = Ctx.Memory.get(F, DT);
+    AAResults &AA = Ctx.Memory.aa();
+    MemorySSAUpdater Updater(&MSSA);
+    MemorySSAWalker *Walker = MSSA.getWalker();
+
+    DenseMap<std::pair<MemoryAccess *, Value *>, SmallVector<LoadInst *, 2>> Loads;
+    for (DomTreeNode *N : depth_first(DT.getRootNode())) {
+        for (auto i = N->getBlock()->begin(); i != N->getBlock()->end();) {
+            if (!Ctx.Budget.step())
+                return;
+            LoadInst *LI = dyn_cast<LoadInst>(&*i++);
+            if (!LI || !LI->isSimple())
+                continue;
+            MemoryAccess *Clobber = Walker->getClobberingMemoryAccess(LI);
+            Value *Ptr = LI->getPointerOperand();
+
+            StoreInst *SI = nullptr;
+            if (MemoryDef *Def = dyn_cast<MemoryDef>(Clobber))
+                SI = dyn_cast_or_null<StoreInst>(Def->getMemoryInst());
+            if (SI && SI->isSimple() && SI->getValueOperand()->getType() == LI->getType() &&
+                (SI->getPointerOperand() == Ptr ||
+                 AA.isMustAlias(MemoryLocation::get(SI), MemoryLocation::get(LI)))) {
+                Updater.removeMemoryAccess(LI);
+                cse_replace(LI, SI->getValueOperand(), S.CSEStore2Load, Ctx);
+                continue;
+            }
+
+            SmallVector<LoadInst *, 2> &Same = Loads[{Clobber, Ptr}];
+            auto Avail = find_if(Same, [&](LoadInst *L) {
+                return L->getType() == LI->getType() && Ctx.Dom.dominates(L, LI);
+            });
+            if (Avail != Same.end()) {
+                Updater.removeMemoryAccess(LI);
+                cse_replace(LI, *Avail, S.CSELdElim, Ctx);
+                continue;
+            }
+            Same.push_back(LI);
+        }
+    }
+}
+
+/* Does K overwrite all of what S writes on every path from S to the exit?
+ * Paths through an exception are not in the post-dominator tree; they are
+ * checked by cse_path_clear. */
+inline bool cse_overwrites(StoreInst *K, StoreInst *S, PostDominatorTree &PDT, const DataLayout &DL)
+{
+    if (K == S || !K->isSimple() ||
+        DL.getTypeStoreSize(K->getValueOperand()->getType()) <
+                DL.getTypeStoreSize(S->getValueOperand()->getType()))
+        return false;
+    if (K->getParent() == S->getParent())
+        return S->comesBefore(K);
+    return PDT.dominates(K->getParent(), S->getParent());
+}
+
+/* The instructions of each block that may throw, found on first use */
+typedef DenseMap<BasicBlock *, SmallVector<Instruction *, 2>> CSEThrowMap;
+
+/* Do S and K write the same address, with nothing that may throw between
+ * them, so that neither the caller nor a later iteration sees what S
+ * wrote? Paths from S to K that run the instruction computing the pointer
+ * again (around a loop) would store to a new address. Gives up after Limit
+ * blocks. */
+inline bool cse_path_clear(StoreInst *S, StoreInst *K, unsigned Limit, CSEThrowMap &Throwing)
+{
+    BasicBlock *SB = S->getParent();
+    BasicBlock *KB = K->getParent();
+    Instruction *PtrDef = dyn_cast<Instruction>(S->getPointerOperand());
+    /* Nothing in BB after From (if set) and before To (if set) may throw */
+    auto clear = [&](BasicBlock *BB, Instruction *From, Instruction *To) {
+        auto T = Throwing.find(BB);
+        if (T == Throwing.end()) {
+            T = Throwing.insert({BB, {}}).first;
+            for (Instruction &I : *BB) {
+                if (I.mayThrow())
+                    T->second.push_back(&I);
+            }
+        }
+        for (Instruction *I : T->second) {
+            if ((!From || From->comesBefore(I)) && (!To || I->comesBefore(To)))
+                return false;
+        }
+        return true;
+    };
+    /* The pointer is computed before S, which it dominates */
+    if (SB == KB)
+        return clear(SB, S, K);
+    if (!clear(SB, S, nullptr))
+        return false;
+
+    SmallPtrSet<BasicBlock *, 16> Seen;
+    SmallVector<BasicBlock *, 16> Work(succ_begin(SB), succ_end(SB));
+    while (!Work.empty()) {
+        BasicBlock *BB = Work.pop_back_val();
+        if (!Seen.insert(BB).second)
+            continue;
+        if (Seen.size() > Limit)
+            return false;
+        if (BB == KB) {
+            if (!clear(BB, nullptr, K) || (PtrDef && PtrDef->getParent() == BB && PtrDef->comesBefore(K)))
+                return false;
+            continue;
+        }
+        if (!clear(BB, nullptr, nullptr) || (PtrDef && PtrDef->getParent() == BB))
+            return false;
+        Work.append(succ_begin(BB), succ_end(BB));
+    }
+    return true;
+}
+
+/* Dead stores across the whole function. A store S is dead when a later
+ * store K of at least as many bytes to the same pointer post-dominates it
+ * and nothing can see the value of S before K:
+ * ■	no access that may read the location of S follows S in MemorySSA
+ *	before K; the def-use chains from S are walked until K, which is the
+ *	first such store they reach
+ * ■	nothing between S and K may throw or compute the pointer anew
+ * Both walks give up after a fixed number of steps and keep S.
+ * */
+inline void cse_global_stores(Function &F, CSEContext &Ctx)
+{
+    const unsigned WalkLimit = 256;
+    CSEStatistics &S = Ctx.Stats;
+    const DataLayout &DL = F.getParent()->getDataLayout();
+    MemorySSA &MSSA = Ctx.Memory.get(F, Ctx.Dom.get(F));
+    AAResults &AA = Ctx.Memory.aa();
+    PostDominatorTree &PDT = Ctx.Memory.postdom();
+    MemorySSAUpdater Updater(&MSSA);
+
+    /* The store that overwrites what SI wrote before anything reads it, or
+     * nullptr */
+    auto killer = [&](StoreInst *SI) -> StoreInst * {
+        MemoryLocation Loc = MemoryLocation::get(SI);
+        StoreInst *K = nullptr;
+        SmallPtrSet<MemoryAccess *, 32> Seen;
+        SmallVector<MemoryAccess *, 32> Work{MSSA.getMemoryAccess(SI)};
+        while (!Work.empty()) {
+            MemoryAccess *MA = Work.pop_back_val();
+            for (User *U : MA->users()) {
+                MemoryAccess *Next = cast<MemoryAccess>(U);
+                if (!Seen.insert(Next).second)
+                    continue;
+                if (Seen.size() > WalkLimit)
+                    return nullptr;
+                if (auto *UD = dyn_cast<MemoryUseOrDef>(Next)) {
+                    Instruction *I = UD->getMemoryInst();
+                    StoreInst *Later = dyn_cast<StoreInst>(I);
+                    /* The paths through K need not be followed further */
+                    if (Later && Later->getPointerOperand() == SI->getPointerOperand() &&
+                        cse_overwrites(Later, SI, PDT, DL)) {
+                        if (K && K != Later)
+                            return nullptr;
+                        K = Later;
+                        continue;
+                    }
+                    if (isRefSet(AA.getModRefInfo(I, Loc)))
+                        return nullptr;
+                }
+                if (!isa<MemoryUse>(Next))
+                    Work.push_back(Next);
+            }
+        }
+        return K;
+    };
+
+    CSEThrowMap Throwing;
+    SmallVector<StoreInst *, 32> Stores;
+    for (BasicBlock &BB : F) {
+        for (Instruction &I : BB) {
+            if (StoreInst *SI = dyn_cast<StoreInst>(&I))
+                Stores.push_back(SI);
+        }
+    }
+    for (StoreInst *SI : Stores) {
+        if (!Ctx.Budget.step())
+            return;
+        if (!SI->isSimple())
+            continue;
+        StoreInst *K = killer(SI);
+        if (!K || !cse_path_clear(SI, K, WalkLimit, Throwing))
+            continue;
+        Updater.removeMemoryAccess(SI);
+        cse_erase(SI, S.CSEStElim, Ctx);
+    }
+}
+
+/* One entry of the explicit preorder walk over the dominator tree. The scope
+ * lives as long as the node is on the stack.
+ * */
+struct CSEStackNode {
+    CSEExprScope Scope;
+    DomTreeNode *Node;
+    DomTreeNode::const_iterator NextChild;
+    bool Processed;
+
+    CSEStackNode(CSEExprTable &Table, DomTreeNode *N)
+            : Scope(Table), Node(N), NextChild(N->begin()), Processed(false) {}
+};
+
+/* Replace every instruction whose expression is already available in a
+ * dominating position. Each instruction is looked up exactly once. */
+inline void cse_value_numbering(BasicBlock *BB, CSEExprTable &Table, CSEContext &Ctx)
+{
+    CSEStatistics &S = Ctx.Stats;
+    for (auto i = BB->begin(); i != BB->end();) {
+        Instruction *I = &*i++;
+        if (!Ctx.Budget.step())
+            return;
+
+        if (!cse_check_opcode(*I))
+            continue;
+
+        if (Instruction *Avail = Table.lookup(I)) {
+            assert(Ctx.Dom.dominates(Avail, I) && "available expression must dominate");
+            /* Keep only the flags (nsw, exact, fast-math...) both agree on */
+            Avail->andIRFlags(I);
+            cse_replace(I, Avail, isa<CallInst>(Avail) ? S.CSECallElim : S.CSEElim, Ctx);
+        } else {
+            Table.insert(I, I);
+        }
+    }
+}
+
+/* Look for an instruction computing the same expression as I that dominates
+ * it, or that I dominates, among the users of one of I's operands. Used for
+ * instructions whose operands changed after the dominator tree walk. An
+ * operand with UserLimit uses or more is not scanned: N similar users of one
+ * value would cost O(N^2). If every operand has that many, I is left as is. */
+inline void cse_find_equivalent(Instruction *I, CSEContext &Ctx)
+{
+    const unsigned UserLimit = 64;
+    CSEStatistics &S = Ctx.Stats;
+    Value *Pivot = nullptr;
+    for (Value *Op : I->operands()) {
+        if (!isa<Constant>(Op) && !Op->hasNUsesOrMore(UserLimit)) {
+            Pivot = Op;
+            break;
+        }
+    }
+    if (!Pivot)
+        return;
+
+    /* A user appears once per use, so collect without duplicates */
+    SmallSetVector<Instruction *, 4> Dominated;
+    for (User *U : Pivot->users()) {
+        Instruction *J = dyn_cast<Instruction>(U);
+        if (!J || J == I || J->getFunction() != I->getFunction() ||
+            !DenseMapInfo<CSEExpr>::isEqual(I, J) || !cse_check_opcode(*J))
+            continue;
+        if (Ctx.Dom.dominates(J, I)) {
+            J->andIRFlags(I);
+            cse_replace(I, J, isa<CallInst>(J) ? S.CSECallElim : S.CSEElim, Ctx);
+            return;
+        }
+        if (Ctx.Dom.dominates(I, J))
+            Dominated.insert(J);
+    }
+    for (Instruction *J : Dominated) {
+        I->andIRFlags(J);
+        cse_replace(J, I, isa<CallInst>(I) ? S.CSECallElim : S.CSEElim, Ctx);
+    }
+}
+
+/* Can I be computed earlier, in a block that dominates it? It must not trap
+ * or have any effect where it would not have run. */
+inline bool cse_hoistable(Instruction &I)
+{
+    return cse_check_opcode(I) && isSafeToSpeculativelyExecute(&I);
+}
+
+/* Expressions computed in every successor of a branch, moved up into the
+ * branching block and computed once. Only branches whose successors have no
+ * other predecessor take part: the branching block is their immediate
+ * dominator, so an operand defined outside a successor is available before
+ * the branch. The blocks are visited in postorder of the dominator tree, so
+ * an expression can move up through several nested branches.
+ *
+ * The expressions of each successor but the first are in a table. An entry
+ * is only made once all operands are available, after which they do not
+ * change while the branch is done.
+ * */
+inline void cse_hoist(DominatorTree &DT, CSEContext &Ctx)
+{
+    CSEStatistics &S = Ctx.Stats;
+    /* Are the operands of I defined before the branch? */
+    auto available = [](Instruction *I) {
+        return none_of(I->operands(), [I](Value *Op) {
+            Instruction *OpI = dyn_cast<Instruction>(Op);
+            return OpI && OpI->getParent() == I->getParent();
+        });
+    };
+
+    std::vector<DenseMap<CSEExpr, Instruction *>> Tables;
+    for (DomTreeNode *N : post_order(DT.getRootNode())) {
+        BasicBlock *BB = N->getBlock();
+        Instruction *T = BB->getTerminator();
+        if (!isa<BranchInst>(T) && !isa<SwitchInst>(T))
+            continue;
+        SmallSetVector<BasicBlock *, 4> Succs(succ_begin(BB), succ_end(BB));
+        if (Succs.size() < 2 || any_of(Succs, [BB](BasicBlock *Succ) {
+                return Succ == BB || Succ->getUniquePredecessor() != BB;
+            }))
+            continue;
+
+        Tables.clear();
+        Tables.resize(Succs.size());
+        for (unsigned k = 1; k < Succs.size(); k++) {
+            for (Instruction &J : *Succs[k]) {
+                if (!Ctx.Budget.step())
+                    return;
+                if (cse_hoistable(J) && available(&J))
+                    Tables[k].insert({&J, &J});
+            }
+        }
+
+        for (auto i = Succs[0]->begin(); i != Succs[0]->end();) {
+            Instruction *I = &*i++;
+            if (!Ctx.Budget.step())
+                return;
+            if (!cse_hoistable(*I) || !available(I))
+                continue;
+            SmallVector<Instruction *, 4> Copies;
+            for (unsigned k = 1; k < Succs.size(); k++) {
+                Instruction *J = Tables[k].lookup(I);
+                if (!J)
+                    break;
+                Copies.push_back(J);
+            }
+            if (Copies.size() != Succs.size() - 1)
+                continue;
+
+            I->moveBefore(T);
+            /* Metadata such as !range may only have held on one path */
+            I->dropUnknownNonDebugMetadata();
+            for (unsigned k = 1; k < Succs.size(); k++) {
+                Instruction *J = Copies[k - 1];
+                SmallVector<Instruction *, 8> Users;
+                for (User *U : J->users()) {
+                    if (cast<Instruction>(U)->getParent() == Succs[k])
+                        Users.push_back(cast<Instruction>(U));
+                }
+                Tables[k].erase(J);
+                I->andIRFlags(J);
+                I->applyMergedLocation(I->getDebugLoc(), J->getDebugLoc());
+                cse_replace(J, I, S.CSEHoist, Ctx);
+                /* Users of J may now be computed before the branch too */
+                for (Instruction *U : Users) {
+                    if (cse_hoistable(*U) && available(U))
+                        Tables[k].insert({U, U});
+                }
+            }
+            /* A copy after the join is now dominated by I */
+            Ctx.Worklist.push(I);
+        }
+    }
+}
+
+/* Loop invariant expressions, moved into the preheader of their loop.
+ * Loops without a preheader are left alone, adding one would change the
+ * CFG. Inner loops go first, so an expression leaves as many loops of a
+ * nest as its operands allow. The blocks of a loop are visited down the
+ * dominator tree, so operands move before their users.
+ * */
+inline void cse_licm(DominatorTree &DT, CSEContext &Ctx)
+{
+    CSEStatistics &S = Ctx.Stats;
+    LoopInfo LI(DT);
+    SmallVector<Loop *, 8> Loops = LI.getLoopsInPreorder();
+    for (Loop *L : reverse(Loops)) {
+        BasicBlock *Preheader = L->getLoopPreheader();
+        if (!Preheader)
+            continue;
+        /* Every block of the loop is dominated by a block of the loop, up
+         * to the header */
+        SmallVector<DomTreeNode *, 16> Work{DT.getNode(L->getHeader())};
+        while (!Work.empty()) {
+            DomTreeNode *N = Work.pop_back_val();
+            for (auto i = N->getBlock()->begin(); i != N->getBlock()->end();) {
+                Instruction *I = &*i++;
+                if (!Ctx.Budget.step())
+                    return;
+                if (!cse_hoistable(*I) || !L->hasLoopInvariantOperands(I))
+                    continue;
+                S.CSELICM++;
+                cse_remark(Ctx, S.CSELICM, I, "moved to", Preheader);
+                Ctx.Changed.insert(I->getFunction());
+                I->moveBefore(Preheader->getTerminator());
+                I->dropUnknownNonDebugMetadata();
+                I->updateLocationAfterHoist();
+                Ctx.Worklist.push(I);
+            }
+            for (DomTreeNode *Child : N->children()) {
+                if (L->contains(Child->getBlock()))
+                    Work.push_back(Child);
+            }
+        }
+    }
+}
+
+/* Follow up every change made to F until nothing changes any more. Only the
+ * queued instructions (users and operands of what changed) are revisited,
+ * and only the blocks whose loads or stores changed are swept again. */
+inline void cse_fixpoint(Function &F, CSEContext &Ctx)
+{
+    if (!Ctx.Fixpoint || Ctx.Budget.exhausted()) {
+        Ctx.Worklist.clear();
+        Ctx.DirtyBlocks.clear();
+        return;
+    }
+
+    const DataLayout &DL = F.getParent()->getDataLayout();
+    CSEFunctionProfile *P = Ctx.Profile.get(F);
+    {
+        CSEProfileRegion R(P, &CSEFunctionProfile::DomTree);
+        Ctx.Dom.get(F);
+    }
+    CSEProfileRegion R(P, &CSEFunctionProfile::Fixpoint);
+    while (!Ctx.Worklist.empty() || !Ctx.DirtyBlocks.empty()) {
+        while (Instruction *I = Ctx.Worklist.pop()) {
+            if (!Ctx.Budget.step()) {
+                Ctx.Worklist.clear();
+                Ctx.DirtyBlocks.clear();
+                return;
+            }
+            if (P)
+                P->WorklistItems++;
+            if (!cse_dead_or_simplify(I, DL, Ctx) && cse_check_opcode(*I))
+                cse_find_equivalent(I, Ctx);
+        }
+        if (!Ctx.DirtyBlocks.empty())
+            cse_memory_block(Ctx.DirtyBlocks.pop_back_val(), Ctx);
+    }
+}
+
+inline void CommonSubexpressionElimination(Module &M, CSEContext &Ctx) {
+
+    /* The following optimizations are handled in this function
+     * Optimization 0: Eliminate dead instructions
+     * Optimization 1: Simplify Instructions
+     * */
+    //RunDeadCodeElimination(M);
+
+    // loop over functions
+    for(auto f = M.begin(); f!=M.end(); f++)
+    {
+        CommonSubexpressionElimination(*f, Ctx);
+    }
+}
+
+inline void CommonSubexpressionElimination(Function &F, CSEContext &Ctx)
+{
+    if (F.empty())
+        return;
+    CSEFunctionProfile *P = Ctx.Profile.get(F);
+    CSEBudgetScope Budget(Ctx.Budget, F);
+
+    /* The tree is computed once per function; none of the phases change
+     * the CFG. */
+    DominatorTree *DT;
+    {
+        CSEProfileRegion R(P, &CSEFunctionProfile::DomTree);
+        DT = &Ctx.Dom.get(F);
+    }
+
+    /* Redundant loads, forwarding of stored values to later loads and
+     * removal of overwritten stores, in one sweep over the dominator
+     * tree. With GlobalLoads and GlobalStores, loads and stores across
+     * blocks with alias analysis first. */
+    {
+        CSEProfileRegion R(P, &CSEFunctionProfile::Memory);
+        if (Ctx.GlobalLoads)
+            cse_global_loads(F, Ctx);
+        if (Ctx.GlobalStores)
+            cse_global_stores(F, Ctx);
+        /* The phases after these do not keep MemorySSA up to date */
+        Ctx.Memory.release();
+        cse_memory(F, *DT, Ctx);
+    }
+
+    /* Common Subexpression Elimination */
+    /* Walk the dominator tree in preorder and value number every
+     * expression. A redundancy is found anywhere in the dominated
+     * subtree, not only in the immediate children. */
+
+    {
+        CSEProfileRegion VN(P, &CSEFunctionProfile::ValueNumbering);
+        CSEExprTable Table;
+        std::vector<std::unique_ptr<CSEStackNode>> Stack;
+        Stack.push_back(std::make_unique<CSEStackNode>(Table, DT->getRootNode()));
+
+        while (!Stack.empty())
+        {
+            CSEStackNode *Top = Stack.back().get();
+            if (!Top->Processed)
+            {
+                BasicBlock *CurrBB = Top->Node->getBlock();
+                cse_value_numbering(CurrBB, Table, Ctx);
+                Top->Processed = true;
+            }
+            if (Top->NextChild != Top->Node->end())
+            {
+                DomTreeNode *Child = *Top->NextChild++;
+                Stack.push_back(std::make_unique<CSEStackNode>(Table, Child));
+            } else {
+                Stack.pop_back();
+            }
+        }
+    }
+
+    /* Code hoisting. Expressions of sibling branches and of loops move up
+     * the dominator tree; the fixpoint merges them with the copies they
+     * now dominate. */
+    if (Ctx.Hoist || Ctx.LICM) {
+        CSEProfileRegion R(P, &CSEFunctionProfile::Hoist);
+        if (Ctx.Hoist)
+            cse_hoist(*DT, Ctx);
+        if (Ctx.LICM)
+            cse_licm(*DT, Ctx);
+    }
+
+    cse_fixpoint(F, Ctx);
+    if (P)
+        P->InstructionsAfter = F.getInstructionCount();
+}
+
+inline void RunDeadCodeElimination(Module &M, CSEContext &Ctx)
+{
+    // loop over functions
+    for(auto f = M.begin(); f!=M.end(); f++) {
+        RunDeadCodeElimination(*f, Ctx);
+    }
+}
+
+inline void RunDeadCodeElimination(Function &F, CSEContext &Ctx)
+{
+    if (F.empty())
+        return;
+
+    /* Queue and count every instruction. The list is popped from the
+     * back, so users are seen before their operands, and erasing a dead
+     * instruction queues the operands it held the last use of: a whole
+     * dead expression tree goes away in one pass. */
+    const DataLayout &DL = F.getParent()->getDataLayout();
+    CSEFunctionProfile *P = Ctx.Profile.get(F);
+    if (P)
+        P->InstructionsBefore = F.getInstructionCount();
+    CSEBudgetScope Budget(Ctx.Budget, F);
+    {
+        CSEProfileRegion R(P, &CSEFunctionProfile::DCE);
+        Ctx.Summary.Functions++;
+        // loop over basic blocks
+        for (auto bb = F.begin(); bb != F.end(); bb++) {
+            // loop over instructions
+            for (auto i = bb->begin(); i != bb->end(); i++) {
+                Ctx.Worklist.push(&*i);
+                Ctx.Summary.add(*i);
+            }
+        }
+        while (Instruction *I = Ctx.Worklist.pop()) {
+            if (!Ctx.Budget.step())
+                break;
+            cse_dead_or_simplify(I, DL, Ctx);
+        }
+    }
+
+    cse_fixpoint(F, Ctx);
+}
+
+inline bool isDead(Instruction &I)
+{
+    /*
+        Check necessary requirements, otherwise return false
+     */
+    if ( I.use_begin() == I.use_end() )
+    {
+        int opcode = I.getOpcode();
+        switch(opcode){
+            case Instruction::Add:
+            case Instruction::FNeg:
+            case Instruction::FAdd:
+            case Instruction::Sub:
+            case Instruction::FSub:
+            case Instruction::Mul:
+            case Instruction::FMul:
+            case Instruction::UDiv:
+            case Instruction::SDiv:
+            case Instruction::FDiv:
+            case Instruction::URem:
+            case Instruction::SRem:
+            case Instruction::FRem:
+            case Instruction::Shl:
+            case Instruction::LShr:
+            case Instruction::AShr:
+            case Instruction::And:
+            case Instruction::Or:
+            case Instruction::Xor:
+            //case Instruction::Alloca:
+            case Instruction::GetElementPtr:
+            case Instruction::Trunc:
+            case Instruction::ZExt:
+            case Instruction::SExt:
+            case Instruction::FPToUI:
+            case Instruction::FPToSI:
+            case Instruction::UIToFP:
+            case Instruction::SIToFP:
+            case Instruction::FPTrunc:
+            case Instruction::FPExt:
+            case Instruction::PtrToInt:
+            case Instruction::IntToPtr:
+            case Instruction::BitCast:
+            case Instruction::AddrSpaceCast:
+            case Instruction::ICmp:
+            case Instruction::FCmp:
+            case Instruction::PHI:
+            case Instruction::Select:
+            case Instruction::ExtractElement:
+            case Instruction::InsertElement:
+            case Instruction::ShuffleVector:
+            case Instruction::ExtractValue:
+            case Instruction::InsertValue:
+                return true; // dead, but this is not enough
+
+            case Instruction::Load:
+            {
+                LoadInst *li = dyn_cast<LoadInst>(&I);
+                if (li && li->isVolatile())
+                    return false;
+                return true;
+            }
+            default:
+                // any other opcode fails
+                return false;
+        }
+    }
+
+    return false;
+}
+
+inline bool cse_check_opcode(Instruction &I)
+{
+    /* Calls that do not touch memory; the ones that read it are merged by
+     * the memory sweep */
+    if (isa<CallInst>(I))
+        return cse_pure_call(I) && cast<CallInst>(I).doesNotAccessMemory();
+
+    bool mRetVal = true;
+    int opcode = I.getOpcode();
+    switch (opcode) {
+        case Instruction::Add:
+        case Instruction::FNeg:
+        case Instruction::FAdd:
+        case Instruction::Sub:
+        case Instruction::FSub:
+        case Instruction::Mul:
+        case Instruction::FMul:
+        case Instruction::UDiv:
+        case Instruction::SDiv:
+        case Instruction::FDiv:
+        case Instruction::URem:
+        case Instruction::SRem:
+        case Instruction::FRem:
+        case Instruction::Shl:
+        case Instruction::LShr:
+        case Instruction::AShr:
+        case Instruction::And:
+        case Instruction::Or:
+        case Instruction::Xor:
+        case Instruction::GetElementPtr:
+        case Instruction::ICmp:
+        case Instruction::FCmp:
+        case Instruction::Trunc:
+        case Instruction::ZExt:
+        case Instruction::SExt:
+        case Instruction::FPTrunc:
+        case Instruction::FPExt:
+        case Instruction::FPToUI:
+        case Instruction::FPToSI:
+        case Instruction::UIToFP:
+        case Instruction::SIToFP:
+        case Instruction::PtrToInt:
+        case Instruction::IntToPtr:
+        case Instruction::BitCast:
+        case Instruction::AddrSpaceCast:
+        case Instruction::Select:
+        case Instruction::ExtractElement:
+        case Instruction::InsertElement:
+        case Instruction::ShuffleVector:
+            mRetVal = true;
+            break;
+        default:
+            mRetVal = false;
+            break;
+    }
+
+    if(I.isVolatile())
+    {
+        mRetVal = false;
+    }
+    if(I.isTerminator() || I.isExceptionalTerminator() || I.isIndirectTerminator() || I.mayHaveSideEffects() || (!I.isSafeToRemove()))
+    {
+        mRetVal = false;
+    }
+    //mRetVal = false;
+    return mRetVal;
+
+}
+
+} // namespace p2
+
+#endif // P2_CSEPASS_H
@@ -0,0 +1,184 @@
+/* p2 as a pass plugin for the new pass manager, so DCE and CSE can run inside
+ * an opt pipeline without writing the module out and parsing it back:
+ *
+ *   opt -load-pass-plugin=P2CSE.so -passes='p2-dce,p2-cse' in.bc -o out.bc
+ *
+ * p2 runs both, in the same order as the p2 tool. p2-cse and p2 take the
+ * options global-loads, global-stores, hoist, licm, budget-insts and
+ * budget-ms of the p2 tool as parameters, as in
+ * p2<global-loads;hoist;budget-ms=50>. p2 runs DCE and CSE in one pass, so
+ * both count against the same budget. The dominator tree, MemorySSA, alias
+ * analysis and the post-dominator tree come from the
+ * FunctionAnalysisManager. Neither pass changes the CFG, so it and every
+ * other CFG analysis stay valid. With opt -pass-remarks-output or
+ * -pass-remarks=p2, every change is reported as an optimization remark.
+ * */
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Passes/PassPlugin.h"
+
+#include "CSEPass.h"
+
+using namespace llvm;
+using namespace p2;
+
+#define DEBUG_TYPE "p2"
+
+STATISTIC(NumCSEDead, "CSE found dead instructions");
+STATISTIC(NumCSEElim, "CSE redundant instructions");
+STATISTIC(NumCSECallElim, "CSE redundant calls");
+STATISTIC(NumCSESimplify, "CSE simplified instructions");
+STATISTIC(NumCSELdElim, "CSE redundant loads");
+STATISTIC(NumCSEStore2Load, "CSE forwarded store to load");
+STATISTIC(NumCSEStElim, "CSE redundant stores");
+STATISTIC(NumCSEHoist, "CSE hoisted redundant instructions");
+STATISTIC(NumCSELICM, "CSE hoisted loop invariant instructions");
+STATISTIC(NumCSEOverBudget, "CSE functions over budget");
+
+namespace {
+
+/* What is still valid after the changes counted in S */
+PreservedAnalyses preserved(const CSEStatistics &S)
+{
+    uint64_t Changes = S.CSEDead.getValue() + S.CSEElim.getValue() + S.CSECallElim.getValue() +
+                       S.CSESimplify.getValue() + S.CSELdElim.getValue() + S.CSEStore2Load.getValue() +
+                       S.CSEStElim.getValue() + S.CSEHoist.getValue() + S.CSELICM.getValue();
+    if (!Changes)
+        return PreservedAnalyses::all();
+
+    /* Instructions were erased, replaced or moved, no block or edge was
+     * touched */
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
+}
+
+/* Are remarks of p2 wanted by opt? */
+bool remarks_enabled(const Function &F)
+{
+    const LLVMContext &C = F.getContext();
+    return C.getLLVMRemarkStreamer() || C.getDiagHandlerPtr()->isPassedOptRemarkEnabled(DEBUG_TYPE);
+}
+
+/* Add the counters of one run to the totals shown by opt -stats and tell
+ * the pass manager what is still valid. */
+PreservedAnalyses report(const CSEStatistics &S)
+{
+    NumCSEDead += S.CSEDead.getValue();
+    NumCSEElim += S.CSEElim.getValue();
+    NumCSECallElim += S.CSECallElim.getValue();
+    NumCSESimplify += S.CSESimplify.getValue();
+    NumCSELdElim += S.CSELdElim.getValue();
+    NumCSEStore2Load += S.CSEStore2Load.getValue();
+    NumCSEStElim += S.CSEStElim.getValue();
+    NumCSEHoist += S.CSEHoist.getValue();
+    NumCSELICM += S.CSELICM.getValue();
+    NumCSEOverBudget += S.CSEOverBudget.getValue();
+    return preserved(S);
+}
+
+struct P2DCEPass : PassInfoMixin<P2DCEPass> {
+    PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM)
+    {
+        CSEContext Ctx;
+        Ctx.Dom.use(F, AM.getResult<DominatorTreeAnalysis>(F));
+        Ctx.Remarks.Enabled = remarks_enabled(F);
+        RunDeadCodeElimination(F, Ctx);
+        return report(Ctx.Stats);
+    }
+};
+
+struct P2CSEPass : PassInfoMixin<P2CSEPass> {
+    /* Run DCE first, as p2 does */
+    bool WithDCE = false;
+    bool GlobalLoads = false;
+    bool GlobalStores = false;
+    bool Hoist = false;
+    bool LICM = false;
+    unsigned BudgetInsts = 0;
+    unsigned BudgetMS = 0;
+
+    PreservedAnalyses run(Function &F, FunctionAnalysisManager &AM)
+    {
+        CSEContext Ctx;
+        Ctx.Dom.use(F, AM.getResult<DominatorTreeAnalysis>(F));
+        Ctx.GlobalLoads = GlobalLoads;
+        Ctx.GlobalStores = GlobalStores;
+        Ctx.Hoist = Hoist;
+        Ctx.LICM = LICM;
+        Ctx.Remarks.Enabled = remarks_enabled(F);
+        Ctx.Budget.MaxSteps = BudgetInsts;
+        Ctx.Budget.MaxMilliseconds = BudgetMS;
+        if (WithDCE) {
+            RunDeadCodeElimination(F, Ctx);
+            /* A MemorySSA computed before may still refer to what DCE
+             * erased */
+            AM.invalidate(F, preserved(Ctx.Stats));
+        }
+        if (GlobalLoads || GlobalStores)
+            Ctx.Memory.use(F, AM.getResult<MemorySSAAnalysis>(F).getMSSA(),
+                           AM.getResult<AAManager>(F), AM.getResult<PostDominatorTreeAnalysis>(F));
+        CommonSubexpressionElimination(F, Ctx);
+        return report(Ctx.Stats);
+    }
+};
+
+/* The parameters of p2-cse<...> or p2<...> */
+bool parse_cse_params(StringRef Params, P2CSEPass &Pass)
+{
+    SmallVector<StringRef, 4> Names;
+    Params.split(Names, ';', -1, false);
+    for (StringRef N : Names) {
+        if (N.consume_front("budget-insts=")) {
+            if (N.getAsInteger(10, Pass.BudgetInsts))
+                return false;
+        } else if (N.consume_front("budget-ms=")) {
+            if (N.getAsInteger(10, Pass.BudgetMS))
+                return false;
+        } else if (N == "global-loads")
+            Pass.GlobalLoads = true;
+        else if (N == "global-stores")
+            Pass.GlobalStores = true;
+        else if (N == "hoist")
+            Pass.Hoist = true;
+        else if (N == "licm")
+            Pass.LICM = true;
+        else
+            return false;
+    }
+    return true;
+}
+
+} // namespace
+
+extern "C" LLVM_ATTRIBUTE_WEAK PassPluginLibraryInfo llvmGetPassPluginInfo()
+{
+    return {LLVM_PLUGIN_API_VERSION, "P2CSE", LLVM_VERSION_STRING, [](PassBuilder &PB) {
+        PB.registerPipelineParsingCallback(
+                [](StringRef Name, FunctionPassManager &FPM, ArrayRef<PassBuilder::PipelineElement>) {
+                    if (Name == "p2-dce") {
+                        FPM.addPass(P2DCEPass());
+                        return true;
+                    }
+                    if (!Name.consume_front("p2"))
+                        return false;
+                    bool WithDCE = !Name.consume_front("-cse");
+                    if (!Name.empty() && !(Name.consume_front("<") && Name.consume_back(">")))
+                        return false;
+                    P2CSEPass CSE;
+                    CSE.WithDCE = WithDCE;
+                    if (!parse_cse_params(Name, CSE))
+                        return false;
+                    FPM.addPass(std::move(CSE));
+                    return true;
+                });
+    }};
+}
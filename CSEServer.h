@@ -0,0 +1,189 @@
+#ifndef P2_CSESERVER_H
+#define P2_CSESERVER_H
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+
+/* The framing of p2 -server and its clients. A client sends any number of
+ * requests over one stream, the stdin and stdout of p2 -server or a
+ * connection to its Unix socket, and each is answered before the next is
+ * read:
+ *
+ *   request:  "module <n>\n", then n bytes of IR text or bitcode
+ *   response: "ok <n> <m>\n", then n bytes of optimized bitcode and m bytes
+ *             of what p2 writes to <output>.stats, or
+ *             "error <n>\n", then n bytes of messages
+ *
+ * Every module is optimized with the options p2 -server was started with and
+ * counters of its own. Everything here returns false, or -1 for a file
+ * descriptor, when the stream fails or is closed.
+ * */
+namespace p2 {
+
+inline bool cse_write_all(int FD, llvm::StringRef Data)
+{
+    while (!Data.empty()) {
+        ssize_t N = ::write(FD, Data.data(), Data.size());
+        if (N < 0 && errno == EINTR)
+            continue;
+        if (N <= 0)
+            return false;
+        Data = Data.drop_front(N);
+    }
+    return true;
+}
+
+inline bool cse_read_all(int FD, std::string &Data, size_t Size)
+{
+    Data.resize(Size);
+    size_t Done = 0;
+    while (Done < Size) {
+        ssize_t N = ::read(FD, &Data[Done], Size - Done);
+        if (N < 0 && errno == EINTR)
+            continue;
+        if (N <= 0)
+            return false;
+        Done += N;
+    }
+    return true;
+}
+
+/* The header line, split at spaces. It is short, so it is read a byte at a
+ * time and nothing of the payload is consumed. */
+inline bool cse_read_header(int FD, llvm::SmallVectorImpl<std::string> &Fields)
+{
+    std::string Line;
+    char C;
+    for (;;) {
+        ssize_t N = ::read(FD, &C, 1);
+        if (N < 0 && errno == EINTR)
+            continue;
+        if (N <= 0 || Line.size() > 64)
+            return false;
+        if (C == '\n')
+            break;
+        Line += C;
+    }
+    llvm::SmallVector<llvm::StringRef, 4> Parts;
+    llvm::StringRef(Line).split(Parts, ' ', -1, false);
+    Fields.assign(Parts.begin(), Parts.end());
+    return !Fields.empty();
+}
+
+inline bool cse_read_size(llvm::StringRef Field, size_t &Size)
+{
+    unsigned long long V;
+    if (llvm::getAsUnsignedInteger(Field, 10, V))
+        return false;
+    Size = V;
+    return true;
+}
+
+inline bool cse_write_request(int FD, llvm::StringRef Module)
+{
+    return cse_write_all(FD, ("module " + llvm::Twine(Module.size()) + "\n").str()) &&
+           cse_write_all(FD, Module);
+}
+
+inline bool cse_read_request(int FD, std::string &Module)
+{
+    llvm::SmallVector<std::string, 4> F;
+    size_t Size;
+    return cse_read_header(FD, F) && F.size() == 2 && F[0] == "module" && cse_read_size(F[1], Size) &&
+           cse_read_all(FD, Module, Size);
+}
+
+inline bool cse_write_result(int FD, llvm::StringRef Bitcode, llvm::StringRef Stats)
+{
+    return cse_write_all(FD, ("ok " + llvm::Twine(Bitcode.size()) + " " + llvm::Twine(Stats.size()) + "\n").str()) &&
+           cse_write_all(FD, Bitcode) && cse_write_all(FD, Stats);
+}
+
+inline bool cse_write_error(int FD, llvm::StringRef Message)
+{
+    return cse_write_all(FD, ("error " + llvm::Twine(Message.size()) + "\n").str()) && cse_write_all(FD, Message);
+}
+
+/* A response: Ok with Bitcode and Stats, or not Ok with the messages in
+ * Stats */
+inline bool cse_read_response(int FD, bool &Ok, std::string &Bitcode, std::string &Stats)
+{
+    llvm::SmallVector<std::string, 4> F;
+    size_t N, M;
+    if (!cse_read_header(FD, F))
+        return false;
+    if (F.size() == 3 && F[0] == "ok" && cse_read_size(F[1], N) && cse_read_size(F[2], M)) {
+        Ok = true;
+        return cse_read_all(FD, Bitcode, N) && cse_read_all(FD, Stats, M);
+    }
+    if (F.size() == 2 && F[0] == "error" && cse_read_size(F[1], N)) {
+        Ok = false;
+        Bitcode.clear();
+        return cse_read_all(FD, Stats, N);
+    }
+    return false;
+}
+
+inline bool cse_socket_address(llvm::StringRef Path, sockaddr_un &Addr, std::string &Error)
+{
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sun_family = AF_UNIX;
+    if (Path.size() >= sizeof(Addr.sun_path)) {
+        Error = "socket path too long";
+        return false;
+    }
+    memcpy(Addr.sun_path, Path.data(), Path.size());
+    return true;
+}
+
+/* A socket listening at Path. A socket file left by an earlier server is
+ * replaced. */
+inline int cse_listen(llvm::StringRef Path, std::string &Error)
+{
+    sockaddr_un Addr;
+    if (!cse_socket_address(Path, Addr, Error))
+        return -1;
+    int FD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (FD < 0) {
+        Error = strerror(errno);
+        return -1;
+    }
+    ::unlink(Addr.sun_path);
+    if (::bind(FD, (sockaddr *)&Addr, sizeof(Addr)) < 0 || ::listen(FD, 64) < 0) {
+        Error = strerror(errno);
+        ::close(FD);
+        return -1;
+    }
+    return FD;
+}
+
+inline int cse_connect(llvm::StringRef Path, std::string &Error)
+{
+    sockaddr_un Addr;
+    if (!cse_socket_address(Path, Addr, Error))
+        return -1;
+    int FD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (FD < 0) {
+        Error = strerror(errno);
+        return -1;
+    }
+    if (::connect(FD, (sockaddr *)&Addr, sizeof(Addr)) < 0) {
+        Error = strerror(errno);
+        ::close(FD);
+        return -1;
+    }
+    return FD;
+}
+
+} // namespace p2
+
+#endif // P2_CSESERVER_H
@@ -4,11 +4,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/resource.h>
 #include <iostream>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
 
 #include "llvm-c/Core.h"
 
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LLVMRemarkStreamer.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
@@ -26,25 +33,32 @@
 #include "llvm/Analysis/InstructionSimplify.h"
 #include "llvm/Transforms/Utils/Local.h"
 #include "llvm/Support/GenericDomTree.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/ScopedHashTable.h"
+#include "llvm/Support/RecyclingAllocator.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/SetVector.h"
 
-using namespace llvm;
-
-static void CommonSubexpressionElimination(Module &);
-
-static void summarize(Module *M);
-static void print_csv_file(std::string outputfile);
+#include "CSEPass.h"
+#include "CSECache.h"
+#include "CSEServer.h"
 
-bool isDead(Instruction &I);
-void RunDeadCodeElimination(Module &M);
-bool cse_check_opcode(Instruction &I);
-void process_load_worklist();
-void process_store_worklist();
+using namespace llvm;
+using namespace p2;
 
-static cl::opt<std::string>
-        InputFilename(cl::Positional, cl::desc("<input bitcode>"), cl::Required, cl::init("-"));
+static void summarize(Module *M, CSEContext &Ctx);
+static void print_csv(raw_ostream &OS, CSEContext &Ctx);
+static void print_csv_file(std::string outputfile, CSEContext &Ctx);
 
-static cl::opt<std::string>
-        OutputFilename(cl::Positional, cl::desc("<output bitcode>"), cl::Required, cl::init("out.bc"));
+static cl::list<std::string>
+        Positionals(cl::Positional, cl::desc("<input bitcode> <output bitcode> | -batch <inputs...> | -server"), cl::ZeroOrMore);
 
 static cl::opt<bool>
         Mem2Reg("mem2reg",
@@ -65,554 +79,1083 @@ static cl::opt<bool>
         NoCheck("no",
                 cl::desc("Do not check for valid IR."),
                 cl::init(false));
-static llvm::Statistic CSEDead = {"", "CSEDead", "CSE found dead instructions"};
-static llvm::Statistic CSEElim = {"", "CSEElim", "CSE redundant instructions"};
-static llvm::Statistic CSESimplify = {"", "CSESimplify", "CSE simplified instructions"};
-static llvm::Statistic CSELdElim = {"", "CSELdElim", "CSE redundant loads"};
-static llvm::Statistic CSEStore2Load = {"", "CSEStore2Load", "CSE forwarded store to load"};
-static llvm::Statistic CSEStElim = {"", "CSEStElim", "CSE redundant stores"};
-int main(int argc, char **argv) {
-    // Parse command line arguments
-    cl::ParseCommandLineOptions(argc, argv, "llvm system compiler\n");
 
-    // Handle creating output files and shutting down properly
-    llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
-    LLVMContext Context;
+static cl::opt<bool>
+        VerifyAll("verify-all",
+                  cl::desc("Verify the whole module, not only the functions p2 changed."),
+                  cl::init(false));
 
-    // LLVM idiom for constructing output file.
-    std::unique_ptr<ToolOutputFile> Out;
-    std::string ErrorInfo;
-    std::error_code EC;
-    Out.reset(new ToolOutputFile(OutputFilename.c_str(), EC,
-                                 sys::fs::OF_None));
+static cl::opt<bool>
+        NoFixpoint("no-fixpoint",
+                   cl::desc("Run DCE, simplification and CSE once instead of to a fixed point."),
+                   cl::init(false));
 
-    EnableStatistics();
+static cl::opt<bool>
+        GlobalLoads("global-loads",
+                    cl::desc("Eliminate loads made redundant by a dominating load or store in any block, using MemorySSA and alias analysis."),
+                    cl::init(false));
 
-    // Read in module
-    SMDiagnostic Err;
-    std::unique_ptr<Module> M;
-    M = parseIRFile(InputFilename, Err, Context);
+static cl::opt<bool>
+        GlobalStores("global-stores",
+                     cl::desc("Eliminate stores overwritten on every path by a later store, using MemorySSA and post-dominance."),
+                     cl::init(false));
 
-    // If errors, fail
-    if (M.get() == 0)
-    {
-        Err.print(argv[0], errs());
-        return 1;
-    }
+static cl::opt<bool>
+        Hoist("hoist",
+              cl::desc("Compute expressions found in every successor of a branch once, before the branch."),
+              cl::init(false));
 
-    // If requested, do some early optimizations
-    if (Mem2Reg)
-    {
-        legacy::PassManager Passes;
-        Passes.add(createPromoteMemoryToRegisterPass());
-        Passes.run(*M.get());
-    }
+static cl::opt<bool>
+        LICM("licm",
+             cl::desc("Move loop invariant expressions into the loop preheader."),
+             cl::init(false));
 
-    if (!NoCSE) {
-        RunDeadCodeElimination(*M.get());
-        CommonSubexpressionElimination(*M.get());
+static cl::opt<unsigned>
+        BudgetInsts("budget-insts",
+                    cl::desc("Stop optimizing a function after visiting this many instructions; the function keeps what was done so far (0 = no limit)."),
+                    cl::init(0));
 
-        //std::cout << "*****************" << std::endl;
-        std::cout << "* CSEDead--------" << CSEDead.getValue() << std::endl;
-        std::cout << "* CSEElim--------" << CSEElim.getValue() << std::endl;
-        std::cout << "* CSESimplify----" << CSESimplify.getValue() << std::endl;
-        std::cout << "* CSELdElim------" << CSELdElim.getValue() << std::endl;
-        std::cout << "* CSEStore2Load--" << CSEStore2Load.getValue() << std::endl;
-        std::cout << "* CSEStElim------" << CSEStElim.getValue() << std::endl;
-        std::cout << "* Total----------" << (CSEDead.getValue() + CSEElim.getValue() + CSESimplify.getValue() + CSELdElim.getValue() + CSEStore2Load.getValue() + CSEStElim.getValue()) << std::endl;
-        //std::cout << "*****************" << std::endl;
+static cl::opt<unsigned>
+        BudgetMS("budget-ms",
+                 cl::desc("Stop optimizing a function after this many milliseconds (0 = no limit)."),
+                 cl::init(0));
 
-    }
+static cl::opt<bool>
+        TimePhases("time-phases",
+                   cl::desc("Report the time spent in each phase and the peak RSS."),
+                   cl::init(false));
 
-    // Collect statistics on Module
-    summarize(M.get());
-    print_csv_file(OutputFilename);
+static cl::opt<bool>
+        StatsJSON("json-stats",
+                  cl::desc("Also write phase and per-function time and memory to <output>.stats.json."),
+                  cl::init(false));
 
-    if (Verbose)
-        PrintStatistics(errs());
+static cl::opt<bool>
+        Remarks("remarks",
+                cl::desc("Write an optimization remark for every change to <output>.opt.yaml, "
+                         "or <output>.opt.bitstream with -remarks-format=bitstream."),
+                cl::init(false));
 
-    // Verify integrity of Module, do this by default
-    if (!NoCheck)
-    {
-        legacy::PassManager Passes;
-        Passes.add(createVerifierPass());
-        Passes.run(*M.get());
-    }
+static cl::opt<std::string>
+        RemarksFormat("remarks-format",
+                      cl::desc("Format of -remarks: yaml or bitstream."),
+                      cl::init("yaml"));
 
-    // Write final bitcode
-    WriteBitcodeToFile(*M.get(), Out->os());
-    Out->keep();
+static cl::opt<bool>
+        Lazy("lazy",
+             cl::desc("Load the functions of a bitcode input one at a time and optimize each before loading the next."),
+             cl::init(false));
 
-    return 0;
-}
+static cl::opt<std::string>
+        CacheDir("cache-dir",
+                 cl::desc("Reuse optimized functions from this directory and add new ones to it."),
+                 cl::init(""));
 
-static llvm::Statistic nFunctions = {"", "Functions", "number of functions"};
-static llvm::Statistic nInstructions = {"", "Instructions", "number of instructions"};
-static llvm::Statistic nLoads = {"", "Loads", "number of loads"};
-static llvm::Statistic nStores = {"", "Stores", "number of stores"};
+static cl::opt<unsigned>
+        CacheSizeMB("cache-size-mb",
+                    cl::desc("Size limit of the -cache-dir directory in MB."),
+                    cl::init(1024));
 
-static void summarize(Module *M) {
-    for (auto i = M->begin(); i != M->end(); i++) {
-        if (i->begin() != i->end()) {
-            nFunctions++;
-        }
+static cl::opt<bool>
+        Batch("batch",
+              cl::desc("Optimize every input (file, directory of .ll/.bc files or @response file) on a pool of worker threads."),
+              cl::init(false));
 
-        for (auto j = i->begin(); j != i->end(); j++) {
-            for (auto k = j->begin(); k != j->end(); k++) {
-                Instruction &I = *k;
-                nInstructions++;
-                if (isa<LoadInst>(&I)) {
-                    nLoads++;
-                } else if (isa<StoreInst>(&I)) {
-                    nStores++;
-                }
-            }
-        }
-    }
-}
+static cl::opt<std::string>
+        OutputDir("output-dir",
+                  cl::desc("Directory for -batch outputs, named <input>-out.bc."),
+                  cl::init("."));
 
+static cl::opt<unsigned>
+        Threads("j",
+                cl::desc("Number of worker threads for -batch, -parallel and -server (0 = one per core)."),
+                cl::init(0));
+
+static cl::opt<bool>
+        Parallel("parallel",
+                 cl::desc("Optimize the functions of the module on -j worker threads, each loading them "
+                          "lazily into an LLVMContext of its own. Not with -cache-dir."),
+                 cl::init(false));
 
-static void print_csv_file(std::string outputfile)
+static cl::opt<bool>
+        Server("server",
+               cl::desc("Optimize the modules sent over stdin and stdout, or over connections to -socket, "
+                        "as described in CSEServer.h."),
+               cl::init(false));
+
+static cl::opt<std::string>
+        SocketPath("socket",
+                   cl::desc("Unix socket -server listens on."),
+                   cl::init(""));
+
+
+/* Write <output>.stats.json: the module phases, the counters and the
+ * profile of every function. */
+static void print_json_file(const std::string &InputFilename, const std::string &OutputFilename,
+                            ArrayRef<Timer *> PhaseTimers, CSEContext &Ctx, const CSECache *Cache,
+                            raw_ostream &Err)
 {
-    std::ofstream stats(outputfile + ".stats");
-    auto a = GetStatistics();
-    for (auto p : a) {
-        stats << p.first.str() << "," << p.second << std::endl;
+    std::error_code EC;
+    raw_fd_ostream OS(OutputFilename + ".stats.json", EC, sys::fs::OF_Text);
+    if (EC) {
+        Err << OutputFilename << ".stats.json: " << EC.message() << "\n";
+        return;
     }
-    stats.close();
+
+    json::OStream J(OS, 2);
+    J.object([&] {
+        J.attribute("input", InputFilename);
+        J.attribute("output", OutputFilename);
+        J.attribute("peak_rss_kb", (int64_t)peak_rss_kb());
+        J.attributeObject("phases", [&] {
+            for (Timer *T : PhaseTimers) {
+                if (!T->hasTriggered())
+                    continue;
+                TimeRecord R = T->getTotalTime();
+                J.attributeObject(T->getName(), [&] {
+                    J.attribute("wall", R.getWallTime());
+                    J.attribute("user", R.getUserTime());
+                    J.attribute("system", R.getSystemTime());
+                });
+            }
+        });
+        if (Cache)
+            J.attributeObject("cache", [&] {
+                J.attribute("hits", (int64_t)Cache->Hits);
+                J.attribute("misses", (int64_t)Cache->Misses);
+            });
+        J.attributeObject("counters", [&] {
+            for (CSECounter *C : Ctx.Stats.Registered)
+                J.attribute(C->getName(), (int64_t)C->getValue());
+        });
+        J.attributeArray("functions", [&] {
+            for (const CSEFunctionProfile &P : Ctx.Profile.Functions) {
+                J.object([&] {
+                    J.attribute("name", P.Name);
+                    J.attribute("instructions_before", (int64_t)P.InstructionsBefore);
+                    J.attribute("instructions_after", (int64_t)P.InstructionsAfter);
+                    J.attribute("total", P.DCE + P.DomTree + P.Memory + P.ValueNumbering + P.Hoist +
+                                                P.Fixpoint);
+                    J.attributeObject("phases", [&] {
+                        J.attribute("dce", P.DCE);
+                        J.attribute("domtree", P.DomTree);
+                        J.attribute("memory", P.Memory);
+                        J.attribute("value_numbering", P.ValueNumbering);
+                        J.attribute("hoist", P.Hoist);
+                        J.attribute("fixpoint", P.Fixpoint);
+                    });
+                    J.attribute("worklist_items", (int64_t)P.WorklistItems);
+                    J.attribute("peak_rss_kb", (int64_t)P.PeakRSSKB);
+                    J.attribute("peak_rss_growth_kb", (int64_t)P.PeakRSSGrowthKB);
+                });
+            }
+        });
+    });
+    OS << "\n";
 }
 
+/* What p2 does to one function: -mem2reg with FPM, then DCE and CSE */
+static void optimize_function(Function &F, legacy::FunctionPassManager *FPM, CSEContext &Ctx,
+                              std::vector<const char *> *DCEOrder = nullptr,
+                              std::vector<const char *> *CSEOrder = nullptr)
+{
+    if (FPM && FPM->run(F))
+        Ctx.Changed.insert(&F);
+    if (!NoCSE)
+    {
+        Ctx.Stats.trace(DCEOrder);
+        RunDeadCodeElimination(F, Ctx);
+        Ctx.Stats.trace(CSEOrder);
+        CommonSubexpressionElimination(F, Ctx);
+        Ctx.Stats.trace(nullptr);
+    }
+    Ctx.Dom.release();
+}
 
-std::set<Instruction *> load_worklist;
-std::set<Instruction *> store_worklist;
-std::set<Instruction *> store_load_worklist;
+/* A run of consecutive functions of the module, optimized by one worker of
+ * -parallel and sent back as a fragment (see CSECache) */
+struct P2Shard {
+    unsigned Begin = 0;
+    unsigned End = 0;
+    bool Done = false;
+    std::string Error;
+    std::string Fragment;
+    /* The functions in Fragment, where function i is p2.parallel.<i> */
+    std::vector<unsigned> Carried;
+    /* How much the counters went up for them, and their profiles */
+    CSEStatistics Stats;
+    std::vector<CSEFunctionProfile> Profiles;
+    /* The counters DCE and CSE of each of them incremented, see
+     * CSEStatistics::trace */
+    std::vector<const char *> DCEOrder;
+    std::vector<const char *> CSEOrder;
+    /* Whether Fragment went into the module, so Stats count */
+    bool Spliced = false;
+    /* Their remarks, as YAML */
+    std::string Remarks;
+    /* What they add to the summary, and why any of them is broken */
+    CSESummary Summary;
+    std::string Broken;
+};
 
-DominatorTree gDT;
-//TODO: uncomment all volatile checks llvm-12 issue so commented
-void process_load_worklist()
+/* -parallel: optimize the functions of M on worker threads.
+ *
+ * Nothing of an LLVMContext may be changed by two threads at once, and DCE
+ * and CSE change more of it than the functions they work on: the use lists
+ * of the constants and globals an instruction refers to, the uniquing tables
+ * of constants and metadata, metadata attachments. So every worker loads
+ * Bitcode, the input, lazily into a context of its own and materializes
+ * only the functions of the shards it takes. What it optimized goes back to
+ * the main thread as a fragment, which splices the bodies into M in shard
+ * order; M only needs to have its globals loaded. Each worker counts with
+ * its own CSEContext, and the main thread adds up the counters of every
+ * shard, so the totals are those of a serial run. A serial run does DCE on
+ * every function before CSE on any, and .stats lists the counters in the
+ * order they were first incremented: the main thread registers them in that
+ * order from the traces of the shards before adding up. With remarks on, the
+ * remarks of a shard are collected as YAML and written to RemarksOut when its
+ * fragment is spliced, so only a shard at a time is held in memory.
+ *
+ * Unless -verify-all, each worker also verifies the functions it changed,
+ * in its own context, and the messages of the broken ones are added to
+ * Broken. Verifying the functions the main thread optimizes is left to the
+ * caller.
+ *
+ * There are many more shards than workers, and a worker takes the next
+ * shard whenever it is done with one, so a worker that gets large functions
+ * takes fewer shards. Functions that cannot be carried in a fragment (see
+ * CSECache::portable) are optimized by the main thread at the end. */
+static Error optimize_parallel(Module &M, MemoryBufferRef Bitcode, CSEContext &Ctx, raw_ostream *RemarksOut,
+                               std::string &Broken)
 {
-    //return;
-    for(auto p=load_worklist.begin();p!=load_worklist.end();p++)
+    std::vector<Function *> Functions;
+    for (Function &F : M)
+        Functions.push_back(&F);
+    ThreadPoolStrategy Strategy = hardware_concurrency(Threads);
+    unsigned NumWorkers = Strategy.compute_thread_count();
+    unsigned NumShards = std::min<size_t>(Functions.size(), NumWorkers * 16);
+    std::vector<std::unique_ptr<P2Shard>> Shards;
+    for (unsigned i = 0; i < NumShards; i++)
     {
-        Instruction* i = *p;
-        for(auto q=p;q!=load_worklist.end();)
+        Shards.push_back(std::make_unique<P2Shard>());
+        Shards.back()->Begin = (uint64_t)i * Functions.size() / NumShards;
+        Shards.back()->End = (uint64_t)(i + 1) * Functions.size() / NumShards;
+    }
+
+    std::atomic<unsigned> Next(0);
+    std::mutex Lock;
+    std::condition_variable Ready;
+    auto worker = [&]() {
+        LLVMContext Context;
+        CSEContext W;
+        W.Profile.Enabled = Ctx.Profile.Enabled;
+        W.Fixpoint = Ctx.Fixpoint;
+        W.GlobalLoads = Ctx.GlobalLoads;
+        W.GlobalStores = Ctx.GlobalStores;
+        W.Hoist = Ctx.Hoist;
+        W.LICM = Ctx.LICM;
+        W.Budget.MaxSteps = Ctx.Budget.MaxSteps;
+        W.Budget.MaxMilliseconds = Ctx.Budget.MaxMilliseconds;
+
+        std::string LoadError;
+        std::string FunctionRemarks;
+        raw_string_ostream RemarksOS(FunctionRemarks);
+        if (RemarksOut)
+        {
+            if (Error E = setupLLVMOptimizationRemarks(Context, RemarksOS, "", "yaml", false))
+                LoadError = toString(std::move(E));
+            W.Remarks.Enabled = true;
+        }
+
+        std::vector<Function *> Fns;
+        std::unique_ptr<legacy::FunctionPassManager> FPM;
+        Expected<std::unique_ptr<Module>> WM = getLazyBitcodeModule(Bitcode, Context);
+        if (!WM)
+            LoadError = toString(WM.takeError());
+        else
         {
-            Instruction* j = *q;
-            if((i!=j)&&(i->getOperand(0) == j->getOperand(0)) && (!j->isVolatile()) && (i->getType()->getTypeID() == j->getType()->getTypeID()))
+            for (Function &F : **WM)
+                Fns.push_back(&F);
+            if (Fns.size() != Functions.size())
+                LoadError = "functions of the module do not match its bitcode";
+            if (Mem2Reg)
             {
-                if(gDT.dominates(i,j))
+                FPM = std::make_unique<legacy::FunctionPassManager>(WM->get());
+                FPM->add(createPromoteMemoryToRegisterPass());
+                FPM->doInitialization();
+            }
+        }
+
+        for (unsigned i; (i = Next++) < Shards.size();)
+        {
+            P2Shard &S = *Shards[i];
+            S.Error = LoadError;
+            Module Frag("p2.parallel", Context);
+            if (WM)
+            {
+                Frag.setDataLayout((*WM)->getDataLayout());
+                Frag.setTargetTriple((*WM)->getTargetTriple());
+            }
+            for (unsigned j = S.Begin; j < S.End && S.Error.empty(); j++)
+            {
+                Function &F = *Fns[j];
+                if (Error E = F.materialize())
+                {
+                    S.Error = toString(std::move(E));
+                    break;
+                }
+                if (!F.empty() && CSECache::portable(F))
                 {
-                    if(!(j->isTerminator() || j->isExceptionalTerminator() || j->isIndirectTerminator() || j->mayHaveSideEffects() || (!j->isSafeToRemove())))
+                    std::vector<uint64_t> Before = CSECache::snapshot(W.Stats);
+                    size_t Profiled = W.Profile.Functions.size();
+                    CSESummary SummaryBefore = W.Summary;
+                    FunctionRemarks.clear();
+                    std::vector<const char *> DCEOrder, CSEOrder;
+                    optimize_function(F, FPM.get(), W, &DCEOrder, &CSEOrder);
+                    std::string FunctionBroken;
+                    if (!NoCheck && !VerifyAll && W.Changed.count(&F))
                     {
-                        j->replaceAllUsesWith(cast<Value>(&*i));
-                        j->eraseFromParent();
-                        q = load_worklist.erase(q);
-                        CSELdElim++;
-                    }else
+                        raw_string_ostream OS(FunctionBroken);
+                        verifyFunction(F, &OS);
+                    }
+                    if (CSECache::copy_out(F, Frag, "p2.parallel." + Twine(j)))
                     {
-                        q++;
+                        S.Carried.push_back(j);
+                        S.Summary.add(W.Summary, SummaryBefore);
+                        S.Broken += FunctionBroken;
+                        S.Remarks += RemarksOS.str();
+                        S.Stats.add(W.Stats, Before);
+                        S.DCEOrder.insert(S.DCEOrder.end(), DCEOrder.begin(), DCEOrder.end());
+                        S.CSEOrder.insert(S.CSEOrder.end(), CSEOrder.begin(), CSEOrder.end());
+                        S.Profiles.insert(S.Profiles.end(), W.Profile.Functions.begin() + Profiled,
+                                          W.Profile.Functions.end());
                     }
-                }else
-                {
-                    q++;
                 }
-            }else
+                /* Only the functions of the shard being worked on are kept */
+                F.dropAllReferences();
+            }
+            if (S.Error.empty() && !S.Carried.empty())
+            {
+                raw_string_ostream OS(S.Fragment);
+                WriteBitcodeToFile(Frag, OS);
+            }
             {
-                q++;
+                std::lock_guard<std::mutex> L(Lock);
+                S.Done = true;
             }
+            Ready.notify_all();
+        }
+        if (FPM)
+            FPM->doFinalization();
+    };
+
+    ThreadPool Pool(Strategy);
+    for (unsigned i = 0; i < NumWorkers; i++)
+        Pool.async(worker);
+
+    std::vector<bool> Carried(Functions.size());
+    std::string Failure;
+    IRMover Mover(M);
+    for (std::unique_ptr<P2Shard> &SP : Shards)
+    {
+        P2Shard &S = *SP;
+        {
+            std::unique_lock<std::mutex> L(Lock);
+            Ready.wait(L, [&] { return S.Done; });
         }
+        if (!S.Error.empty())
+            Failure = S.Error;
+        if (!Failure.empty() || S.Carried.empty())
+            continue;
+
+        std::vector<std::pair<std::string, Function *>> Bodies;
+        for (unsigned j : S.Carried)
+            Bodies.push_back({("p2.parallel." + Twine(j)).str(), Functions[j]});
+        Expected<std::unique_ptr<Module>> Frag =
+                parseBitcodeFile(MemoryBufferRef(S.Fragment, "p2.parallel"), M.getContext());
+        if (!Frag)
+            consumeError(Frag.takeError());
+        else if (CSECache::splice(M, Mover, std::move(*Frag), Bodies))
+        {
+            for (unsigned j : S.Carried)
+                Carried[j] = true;
+            S.Spliced = true;
+            Ctx.Profile.Functions.insert(Ctx.Profile.Functions.end(), S.Profiles.begin(), S.Profiles.end());
+            Ctx.Summary.add(S.Summary, CSESummary());
+            Broken += S.Broken;
+            if (RemarksOut)
+                *RemarksOut << S.Remarks;
+        }
+        std::string().swap(S.Fragment);
+        std::string().swap(S.Remarks);
+    }
+    Pool.wait();
+    if (!Failure.empty())
+        return createStringError(inconvertibleErrorCode(), Failure);
+
+    /* Adding zero registers a counter */
+    for (std::vector<const char *> P2Shard::*Order : {&P2Shard::DCEOrder, &P2Shard::CSEOrder})
+    {
+        for (std::unique_ptr<P2Shard> &SP : Shards)
+        {
+            if (!SP->Spliced)
+                continue;
+            for (const char *Name : (*SP).*Order)
+                *Ctx.Stats.lookup(Name) += 0;
+        }
+    }
+    for (std::unique_ptr<P2Shard> &SP : Shards)
+    {
+        if (SP->Spliced)
+            Ctx.Stats.add(SP->Stats);
     }
-    load_worklist.clear();
+
+    /* What the workers could not send back */
+    legacy::FunctionPassManager FPM(&M);
+    if (Mem2Reg)
+        FPM.add(createPromoteMemoryToRegisterPass());
+    FPM.doInitialization();
+    for (unsigned j = 0; j < Functions.size(); j++)
+    {
+        if (Carried[j])
+            continue;
+        if (Error E = Functions[j]->materialize())
+            return E;
+        if (!Functions[j]->empty())
+            optimize_function(*Functions[j], Mem2Reg ? &FPM : nullptr, Ctx);
+    }
+    FPM.doFinalization();
+    return M.materializeAll();
 }
 
-void process_store_worklist()
+/* The module for -parallel, with its functions left in Bitcode for the
+ * workers. Bitcode input is loaded lazily, so only its globals are read
+ * here; text input is parsed and written to Written. */
+static std::unique_ptr<Module> load_parallel(const std::string &InputFilename, MemoryBuffer *Buffer,
+                                             std::unique_ptr<MemoryBuffer> &Input, SmallVectorImpl<char> &Written,
+                                             MemoryBufferRef &Bitcode, SMDiagnostic &Diag, LLVMContext &Context)
 {
-    //return;
-    //std::reverse(store_worklist.begin(), store_worklist.end());
-    std::set<Instruction *>::reverse_iterator p;
-    std::set<Instruction *>::reverse_iterator q;
-
-    for(p=store_worklist.rbegin();p!=store_worklist.rend();p++)
+    if (!Buffer)
     {
-        Instruction* i = *p;
-        for(q=p;q!=store_worklist.rend();)
+        ErrorOr<std::unique_ptr<MemoryBuffer>> B = MemoryBuffer::getFileOrSTDIN(InputFilename);
+        if (!B)
         {
-            Instruction* j = *q;
-            if((i!=j)&&(i->getOperand(1) == j->getOperand(1)) && (!j->isVolatile()) && (i->getType()->getTypeID() == j->getType()->getTypeID()))
-            {
-                if(gDT.dominates(i,j))
-                {
-                    if(!(j->isTerminator() || j->isExceptionalTerminator() || j->isIndirectTerminator() || j->mayHaveSideEffects() || (!j->isSafeToRemove())))
-                    {
-                        j->replaceAllUsesWith(cast<Value>(&*i));
-                        j->eraseFromParent();
-                        //std::advance(q,1);
-                        store_worklist.erase(std::next(q).base());
-                        CSEStElim++;
-                    }else
-                    {
-                        q++;
-                    }
-                }else
-                {
-                    q++;
-                }
-            }else
-            {
-                q++;
-            }
+            Diag = SMDiagnostic(InputFilename, SourceMgr::DK_Error,
+                                "Could not open input file: " + B.getError().message());
+            return nullptr;
         }
+        Input = std::move(*B);
+        Buffer = Input.get();
     }
-    store_worklist.clear();
-    //std::reverse(store_worklist.begin(), store_worklist.end());
+    MemoryBufferRef Ref = Buffer->getMemBufferRef();
+    if (isBitcode((const unsigned char *)Ref.getBufferStart(), (const unsigned char *)Ref.getBufferEnd()))
+    {
+        Expected<std::unique_ptr<Module>> M = getLazyBitcodeModule(Ref, Context);
+        if (!M)
+        {
+            Diag = SMDiagnostic(Ref.getBufferIdentifier(), SourceMgr::DK_Error, toString(M.takeError()));
+            return nullptr;
+        }
+        Bitcode = Ref;
+        return std::move(*M);
+    }
+    std::unique_ptr<Module> M = parseIR(Ref, Diag, Context);
+    if (M)
+    {
+        raw_svector_ostream OS(Written);
+        WriteBitcodeToFile(*M, OS);
+        Bitcode = MemoryBufferRef(StringRef(Written.data(), Written.size()), Ref.getBufferIdentifier());
+    }
+    return M;
 }
 
-void process_store_load_worklist()
+/* In memory input and outputs of run_p2, for -server */
+struct P2Buffers {
+    std::unique_ptr<MemoryBuffer> Input;
+    SmallVector<char, 0> Bitcode;
+    std::string Stats;
+};
+
+/* Optimize one input into one output. Anything that would go to stdout or
+ * stderr is written to Out and Err instead. With Buffers the module is read
+ * from and written to memory, InputFilename and OutputFilename only name it
+ * in messages and no file is written. */
+static int run_p2(const std::string &InputFilename, const std::string &OutputFilename,
+                  const char *Argv0, raw_ostream &Out, raw_ostream &Err, P2Buffers *Buffers = nullptr)
 {
-    //return;
-    for(auto p=store_load_worklist.begin();p!=store_load_worklist.end();p++)
+    LLVMContext Context;
+    CSEContext Ctx;
+    CSEStatistics &S = Ctx.Stats;
+    Ctx.Profile.Enabled = StatsJSON;
+    Ctx.Fixpoint = !NoFixpoint;
+    Ctx.GlobalLoads = GlobalLoads;
+    Ctx.GlobalStores = GlobalStores;
+    Ctx.Hoist = Hoist;
+    Ctx.LICM = LICM;
+    Ctx.Budget.MaxSteps = BudgetInsts;
+    Ctx.Budget.MaxMilliseconds = BudgetMS;
+
+    // Wall, user and system time of each phase, for -time-phases and -json-stats
+    TimerGroup Phases("p2", "p2 phases");
+    Timer ParseTimer("parse", "Parse input", Phases);
+    Timer Mem2RegTimer("mem2reg", "Memory to register promotion", Phases);
+    Timer DCETimer("dce", "Dead code elimination", Phases);
+    Timer CSETimer("cse", "Common subexpression elimination", Phases);
+    Timer CacheTimer("cache", "Function cache", Phases);
+    Timer SummaryTimer("summarize", "Summarize module", Phases);
+    Timer VerifyTimer("verify", "Verify module", Phases);
+    Timer WriteTimer("write", "Write bitcode", Phases);
+    auto phase = [](Timer &T) { return TimePhases || StatsJSON ? &T : nullptr; };
+    Timer *PhaseTimers[] = {&ParseTimer, &Mem2RegTimer, &DCETimer, &CSETimer,
+                            &CacheTimer, &SummaryTimer, &VerifyTimer, &WriteTimer};
+
+    // LLVM idiom for constructing output file.
+    std::unique_ptr<ToolOutputFile> OutFile;
+    std::error_code EC;
+    if (!Buffers)
+        OutFile.reset(new ToolOutputFile(OutputFilename, EC,
+                                         sys::fs::OF_None));
+    if (EC)
+    {
+        Err << Argv0 << ": " << OutputFilename << ": " << EC.message() << "\n";
+        return 1;
+    }
+
+    /* -remarks: the remark streamer writes each remark to the file as it is
+     * emitted. Functions found in -cache-dir were not optimized by this run
+     * and get none. */
+    std::unique_ptr<ToolOutputFile> RemarksFile;
+    if (Remarks && !Buffers)
     {
-        Instruction* i = *p;
-        if(i->getOpcode() == Instruction::Store)
+        Expected<std::unique_ptr<ToolOutputFile>> RF = setupLLVMOptimizationRemarks(
+                Context, OutputFilename + ".opt." + RemarksFormat, "", RemarksFormat, false);
+        if (!RF)
         {
-            for (auto q = p; q != store_load_worklist.end();) {
-                Instruction *j = *q;
-                if((i != j) && (j->getOpcode() == Instruction::Store) && (j->getOperand(1) == i->getOperand(1)))
-                {
-                    q++;
-                    break;
-                }else if ((i != j) && (j->getOpcode() == Instruction::Load) && (j->getOperand(0) == i->getOperand(1)) && (!j->isVolatile()) && (j->getType()->getTypeID() == i->getOperand(1)->getType()->getTypeID()))
-                {
-                    if(gDT.dominates(i,j)) {
-                        if(!(j->isTerminator() || j->isExceptionalTerminator() || j->isIndirectTerminator() || j->mayHaveSideEffects() || (!j->isSafeToRemove()))) {
-                            j->replaceAllUsesWith(i->getOperand(0));
-                            j->eraseFromParent();
-                            q = store_load_worklist.erase(q);
-                            CSEStore2Load++;
-                        }else
-                        {
-                            q++;
-                        }
-                    }else
-                    {
-                        q++;
-                    }
-                } else {
-                    q++;
-                }
-            }
+            Err << Argv0 << ": " << toString(RF.takeError()) << "\n";
+            return 1;
         }
+        RemarksFile = std::move(*RF);
+        Ctx.Remarks.Enabled = true;
+    }
+
+    // Read in module
+    SMDiagnostic Diag;
+    /* For -parallel, the bitcode of the input; M loads from it too */
+    std::unique_ptr<MemoryBuffer> ParallelInput;
+    SmallVector<char, 0> ParallelWritten;
+    MemoryBufferRef Bitcode;
+    std::unique_ptr<Module> M;
+    {
+        TimeRegion R(phase(ParseTimer));
+        if (Parallel)
+            M = load_parallel(InputFilename, Buffers ? Buffers->Input.get() : nullptr, ParallelInput,
+                              ParallelWritten, Bitcode, Diag, Context);
+        else if (Buffers && Lazy)
+            M = getLazyIRModule(std::move(Buffers->Input), Diag, Context);
+        else if (Buffers)
+            M = parseIR(Buffers->Input->getMemBufferRef(), Diag, Context);
+        else if (Lazy)
+            M = getLazyIRFileModule(InputFilename, Diag, Context);
+        else
+            M = parseIRFile(InputFilename, Diag, Context);
+    }
+
+    // If errors, fail
+    if (M.get() == 0)
+    {
+        Diag.print(Argv0, Err);
+        return 1;
+    }
+
+    /* With -cache-dir functions found in the cache are not optimized again */
+    std::unique_ptr<CSECache> Cache;
+    if (!CacheDir.empty() && !NoCSE)
+    {
+        std::string Options = formatv("mem2reg={0} fixpoint={1} global-loads={2} global-stores={3} hoist={4} licm={5} "
+                                      "budget-insts={6}",
+                                      (bool)Mem2Reg, !NoFixpoint, (bool)GlobalLoads, (bool)GlobalStores,
+                                      (bool)Hoist, (bool)LICM, (unsigned)BudgetInsts);
+        Cache = std::make_unique<CSECache>(CacheDir, Options, *M);
     }
-    store_load_worklist.clear();
-}
-static void CommonSubexpressionElimination(Module &M) {
 
-    /* The following optimizations are handled in this function
-     * Optimization 0: Eliminate dead instructions
-     * Optimization 1: Simplify Instructions
-     * */
-    //RunDeadCodeElimination(M);
+    /* DCE and CSE of one function, or its optimized body from the cache */
+    auto optimize = [&](Function &F) {
+        if (F.empty())
+            return;
+        std::string Key;
+        std::vector<uint64_t> Before;
+        if (Cache)
+        {
+            TimeRegion R(phase(CacheTimer));
+            Key = Cache->key(F);
+            if (Key.empty())
+                Cache->Misses++;
+            else if (Cache->lookup(F, Key, S))
+            {
+                /* DCE does not see the body from the cache */
+                Ctx.Summary.add(F);
+                Ctx.Changed.insert(&F);
+                return;
+            }
+            Before = CSECache::snapshot(S);
+        }
+        {
+            TimeRegion R(phase(DCETimer));
+            RunDeadCodeElimination(F, Ctx);
+        }
+        {
+            TimeRegion R(phase(CSETimer));
+            CommonSubexpressionElimination(F, Ctx);
+        }
+        /* What a function over budget ends up as may depend on the time
+         * it was given */
+        if (Cache && !Key.empty() && !Ctx.Budget.exhausted(F))
+        {
+            TimeRegion R(phase(CacheTimer));
+            Cache->store(F, Key, S, Before);
+        }
+    };
 
-    /* Common Subexpression Elimination */
-    /* Parse all the blocks and eliminate common sub expressions within the block */
-    // loop over functions
-    for(auto f = M.begin(); f!=M.end(); f++)
+    /* What the workers of -parallel found broken */
+    std::string ParallelBroken;
+    if (Parallel)
     {
-        // loop over basic blocks
-        if (!f->empty())
+        TimeRegion R(phase(CSETimer));
+        if (Error E = optimize_parallel(*M, Bitcode, Ctx, RemarksFile ? &RemarksFile->os() : nullptr,
+                                        ParallelBroken))
+        {
+            Err << Argv0 << ": " << InputFilename << ": " << toString(std::move(E)) << "\n";
+            return 1;
+        }
+    }
+    else if (Lazy)
+    {
+        /* Only the functions done so far and the one being optimized are in
+         * memory, and the analyses of one function are dropped before the
+         * next is loaded. */
+        legacy::FunctionPassManager FPM(M.get());
+        if (Mem2Reg)
+            FPM.add(createPromoteMemoryToRegisterPass());
+        FPM.doInitialization();
+        for (Function &F : *M)
         {
-            gDT = DominatorTree(*f);
-            for (auto bb = f->begin(); bb != f->end(); bb++)
             {
-                if (!bb->empty())
+                TimeRegion R(phase(ParseTimer));
+                if (Error E = F.materialize())
                 {
-                    for (auto i = bb->begin(); i != bb->end(); i++)
-                    {
-                        if (i->getOpcode() == Instruction::Load) {
-                            load_worklist.insert(&*i);
-                            process_store_worklist();
-                        } else if (i->getOpcode() == Instruction::Store) {
-                            store_worklist.insert(&*i);
-                            process_load_worklist();
-                        } else {
-                            /* Checks for
-                             * Do not consider Loads, Stores, Terminators, VAArg, Calls, Allocas, and FCmps
-                             * */
-                            if (cse_check_opcode(*i)) {
-                                bool areOperandsSame;
-                                for (auto j = i; j != bb->end();) {
-                                    /* Checks for
-                                     * ■	Same opcode
-                                     * ■	Same type (LLVMTypeOf of the instruction not its operands)
-                                     * ■	Same number of operands
-                                     * ■	Same operands in the same order (no commutativity)
-                                     * */
-                                    /*volatile static unsigned i_op;
-                                    volatile static unsigned j_op;
-                                    i_op = i->getOpcode();
-                                    j_op = j->getOpcode();*/
-                                    if ((i != j) &&
-                                        (i->getOpcode() == j->getOpcode()) &&
-                                        (i->getType()->getTypeID() == j->getType()->getTypeID()) &&
-                                        (i->getNumOperands() == j->getNumOperands())) {
-                                        areOperandsSame = true;
-                                        for (int w = 0; w < i->getNumOperands(); w++) {
-                                            if (i->getOperand(w) != j->getOperand(w)) {
-                                                areOperandsSame = false;
-                                                break;
-                                            }
-                                        }
-                                        if (areOperandsSame) {
-                                            if(gDT.dominates(&*i,&*j)) {
-                                                j->replaceAllUsesWith(dyn_cast<Value>(i));
-                                                j = j->eraseFromParent();
-                                                CSEElim++;
-                                            }else
-                                            {
-                                                j++;
-                                            }
-                                        } else {
-                                            j++;
-                                        }
-                                    } else {
-                                        j++;
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    process_load_worklist();
-                    process_store_worklist();
+                    Err << Argv0 << ": " << InputFilename << ": " << toString(std::move(E)) << "\n";
+                    return 1;
                 }
             }
+            if (F.empty())
+                continue;
+            if (Mem2Reg)
+            {
+                TimeRegion R(phase(Mem2RegTimer));
+                if (FPM.run(F))
+                    Ctx.Changed.insert(&F);
+            }
+            if (!NoCSE)
+                optimize(F);
+            Ctx.Dom.release();
         }
-    }
+        FPM.doFinalization();
 
-    /* Parse all the children blocks in the dominator tree and eliminate common sub expressions /*/CSEElim++;//remove this
-    for(auto f = M.begin(); f!=M.end(); f++)
+        TimeRegion R(phase(ParseTimer));
+        if (Error E = M->materializeAll())
+        {
+            Err << Argv0 << ": " << InputFilename << ": " << toString(std::move(E)) << "\n";
+            return 1;
+        }
+    }
+    else
     {
-        if (!f->empty())
+        // If requested, do some early optimizations
+        if (Mem2Reg)
         {
-            gDT = DominatorTree(*f);
-            // loop over functions
-            DominatorTree mDT(*f);
+            TimeRegion R(phase(Mem2RegTimer));
+            legacy::FunctionPassManager FPM(M.get());
+            FPM.add(createPromoteMemoryToRegisterPass());
+            FPM.doInitialization();
+            for (Function &F : *M)
+            {
+                if (FPM.run(F))
+                    Ctx.Changed.insert(&F);
+            }
+            FPM.doFinalization();
+        }
 
-            for (auto node = GraphTraits<DominatorTree *>::nodes_begin(&mDT);
-                 node != GraphTraits<DominatorTree *>::nodes_end(&mDT); ++node)
+        if (Cache)
+        {
+            for (Function &F : *M)
+                optimize(F);
+        }
+        else if (!NoCSE)
+        {
             {
-                BasicBlock *CurrBB = node->getBlock();
-                if (!CurrBB->empty())
-                {
-                    for (auto i = CurrBB->begin(); i != CurrBB->end(); i++)
-                    {
-                        /* Checks for
-                         * Do not consider Loads, Stores, Terminators, VAArg, Calls, Allocas, and FCmps
-                         * */
-
-                        if ((i->getOpcode() == Instruction::Load) || (i->getOpcode() == Instruction::Store)) {
-                            store_load_worklist.insert(&*i);
-                        } else {
-                            if (cse_check_opcode(*i)) {
-                                for (auto ChildNode: node->children())
-                                {
-                                    BasicBlock *ChildBB = ChildNode->getBlock();
-                                    if(!ChildBB->empty())
-                                    {
-                                        for (auto j = ChildBB->begin(); j != ChildBB->end();) {
-                                            /* Checks for
-                                             * ■	Same opcode
-                                             * ■	Same type (LLVMTypeOf of the instruction not its operands)
-                                             * ■	Same number of operands
-                                             * ■	Same operands in the same order (no commutativity)
-                                             * */
-                                            if ((i != j) &&
-                                                (i->getOpcode() == j->getOpcode()) &&
-                                                (i->getType()->getTypeID() == j->getType()->getTypeID()) &&
-                                                (i->getNumOperands() == j->getNumOperands())) {
-                                                bool areOperandsSame = true;
-                                                for (int w = 0; w < i->getNumOperands(); w++) {
-                                                    if (i->getOperand(w) != j->getOperand(w)) {
-                                                        areOperandsSame = false;
-                                                        break;
-                                                    }
-                                                }
-                                                if (areOperandsSame) {
-                                                    if(gDT.dominates(&*i,&*j)) {
-                                                        j->replaceAllUsesWith(dyn_cast<Value>(i));
-                                                        j = j->eraseFromParent();
-                                                        CSEElim++;
-                                                    }else
-                                                    {
-                                                        j++;
-                                                    }
-                                                } else {
-                                                    j++;
-                                                }
-                                            } else {
-                                                j++;
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    process_store_load_worklist();
-                }
+                TimeRegion R(phase(DCETimer));
+                RunDeadCodeElimination(*M.get(), Ctx);
+            }
+            {
+                TimeRegion R(phase(CSETimer));
+                CommonSubexpressionElimination(*M.get(), Ctx);
             }
         }
     }
+
+    if (!NoCSE) {
+        //Out << "*****************" << "\n";
+        Out << "* CSEDead--------" << S.CSEDead.getValue() << "\n";
+        Out << "* CSEElim--------" << S.CSEElim.getValue() << "\n";
+        Out << "* CSECallElim----" << S.CSECallElim.getValue() << "\n";
+        Out << "* CSESimplify----" << S.CSESimplify.getValue() << "\n";
+        Out << "* CSELdElim------" << S.CSELdElim.getValue() << "\n";
+        Out << "* CSEStore2Load--" << S.CSEStore2Load.getValue() << "\n";
+        Out << "* CSEStElim------" << S.CSEStElim.getValue() << "\n";
+        Out << "* CSEHoist-------" << S.CSEHoist.getValue() << "\n";
+        Out << "* CSELICM--------" << S.CSELICM.getValue() << "\n";
+        if (BudgetInsts || BudgetMS)
+            Out << "* CSEOverBudget--" << S.CSEOverBudget.getValue() << "\n";
+        Out << "* Total----------" << (S.CSEDead.getValue() + S.CSEElim.getValue() + S.CSECallElim.getValue() + S.CSESimplify.getValue() + S.CSELdElim.getValue() + S.CSEStore2Load.getValue() + S.CSEStElim.getValue() + S.CSEHoist.getValue() + S.CSELICM.getValue()) << "\n";
+        //Out << "*****************" << "\n";
+
+    }
+
+    /* Kept even if the module turns out broken, they may tell why */
+    if (RemarksFile)
+        RemarksFile->keep();
+
+    if (Cache)
+        Err << "Cache: " << Cache->Hits << " hits, " << Cache->Misses << " misses\n";
+
+    // Collect statistics on Module
+    {
+        TimeRegion R(phase(SummaryTimer));
+        summarize(M.get(), Ctx);
+    }
+    if (Buffers)
+    {
+        raw_string_ostream OS(Buffers->Stats);
+        print_csv(OS, Ctx);
+    }
+    else
+        print_csv_file(OutputFilename, Ctx);
+
+    if (Verbose)
+        S.print(Err);
+
+    // Verify integrity of Module, do this by default. Functions p2 did not
+    // change are as valid as they were in the input.
+    bool Broken = false;
+    if (!NoCheck && VerifyAll)
+    {
+        TimeRegion R(phase(VerifyTimer));
+        Broken = verifyModule(*M.get(), &Err);
+    }
+    else if (!NoCheck)
+    {
+        TimeRegion R(phase(VerifyTimer));
+        Err << ParallelBroken;
+        Broken = !ParallelBroken.empty();
+        for (Function &F : *M)
+        {
+            if (Ctx.Changed.count(&F))
+                Broken |= verifyFunction(F, &Err);
+        }
+    }
+    if (Broken)
+    {
+        if (StatsJSON && !Buffers)
+            print_json_file(InputFilename, OutputFilename, PhaseTimers, Ctx, Cache.get(), Err);
+        if (!TimePhases)
+            Phases.clear();
+        Err << Argv0 << ": " << InputFilename << ": broken module found, no output written\n";
+        return 1;
+    }
+
+    // Write final bitcode
+    {
+        TimeRegion R(phase(WriteTimer));
+        if (Buffers)
+        {
+            raw_svector_ostream OS(Buffers->Bitcode);
+            WriteBitcodeToFile(*M.get(), OS);
+        }
+        else
+            WriteBitcodeToFile(*M.get(), OutFile->os());
+    }
+    if (OutFile)
+        OutFile->keep();
+
+    if (StatsJSON && !Buffers)
+    {
+        print_json_file(InputFilename, OutputFilename, PhaseTimers, Ctx, Cache.get(), Err);
+        // The timers only ran for the JSON file, do not print them
+        if (!TimePhases)
+            Phases.clear();
+    }
+
+    if (TimePhases)
+    {
+        Phases.print(Err, /*ResetAfterPrint=*/true);
+        Err << "Peak RSS: " << peak_rss_kb() << " KB\n";
+    }
+
+    return 0;
 }
 
-void RunDeadCodeElimination(Module &M)
+/* Expand the -batch inputs: directories contribute every .ll and .bc file
+ * below them (sorted), response files are already expanded by the command
+ * line parser. */
+static std::vector<std::string> collect_batch_inputs(const char *Argv0)
 {
-    std::set<Instruction*> worklist;
-
-    // loop over functions
-    for(auto f = M.begin(); f!=M.end(); f++) {
-        // loop over basic blocks
-        if (!f->empty()) {
-            for (auto bb = f->begin(); bb != f->end(); bb++) {
-                //SimplifyInstructionsInBlock(&*bb);
-                // loop over instructions
-                if(!bb->empty()) {
-                    for (auto i = bb->begin(); i != bb->end();) {
-                        if (isDead(*i)) {
-                            // remove it!
-                            CSEDead++;
-                            i = i->eraseFromParent();
-                            //worklist.insert(&*i);
-                        } else {
-
-                            const DataLayout &DL = i->getModule()->getDataLayout();
-                            Value *temp = SimplifyInstruction(&*i, {DL});
-                            if (temp) {
-                                CSESimplify++;
-                                i->replaceAllUsesWith(temp);
-                                i = i->eraseFromParent();
-                            } else {
-                                i++;
-                            }
-                        }
-                    }
-                }
-            }
+    std::vector<std::string> Inputs;
+    for (const std::string &P : Positionals)
+    {
+        if (!sys::fs::is_directory(P))
+        {
+            Inputs.push_back(P);
+            continue;
+        }
+        std::vector<std::string> Found;
+        std::error_code EC;
+        for (sys::fs::recursive_directory_iterator I(P, EC), E; I != E && !EC; I.increment(EC))
+        {
+            StringRef Ext = sys::path::extension(I->path());
+            if ((Ext == ".ll" || Ext == ".bc") && !sys::fs::is_directory(I->path()))
+                Found.push_back(I->path());
         }
+        if (EC)
+            errs() << Argv0 << ": " << P << ": " << EC.message() << "\n";
+        std::sort(Found.begin(), Found.end());
+        Inputs.insert(Inputs.end(), Found.begin(), Found.end());
     }
+    return Inputs;
 }
 
-bool isDead(Instruction &I)
+/* Run every input on a worker thread with its own LLVMContext. Output of one
+ * module is buffered and printed in one piece. */
+static int run_batch(const char *Argv0)
 {
-    /*
-        Check necessary requirements, otherwise return false
-     */
-    if ( I.use_begin() == I.use_end() )
-    {
-        int opcode = I.getOpcode();
-        switch(opcode){
-            case Instruction::Add:
-            case Instruction::FNeg:
-            case Instruction::FAdd:
-            case Instruction::Sub:
-            case Instruction::FSub:
-            case Instruction::Mul:
-            case Instruction::FMul:
-            case Instruction::UDiv:
-            case Instruction::SDiv:
-            case Instruction::FDiv:
-            case Instruction::URem:
-            case Instruction::SRem:
-            case Instruction::FRem:
-            case Instruction::Shl:
-            case Instruction::LShr:
-            case Instruction::AShr:
-            case Instruction::And:
-            case Instruction::Or:
-            case Instruction::Xor:
-            //case Instruction::Alloca:
-            case Instruction::GetElementPtr:
-            case Instruction::Trunc:
-            case Instruction::ZExt:
-            case Instruction::SExt:
-            case Instruction::FPToUI:
-            case Instruction::FPToSI:
-            case Instruction::UIToFP:
-            case Instruction::SIToFP:
-            case Instruction::FPTrunc:
-            case Instruction::FPExt:
-            case Instruction::PtrToInt:
-            case Instruction::IntToPtr:
-            case Instruction::BitCast:
-            case Instruction::AddrSpaceCast:
-            case Instruction::ICmp:
-            case Instruction::FCmp:
-            case Instruction::PHI:
-            case Instruction::Select:
-            case Instruction::ExtractElement:
-            case Instruction::InsertElement:
-            case Instruction::ShuffleVector:
-            case Instruction::ExtractValue:
-            case Instruction::InsertValue:
-                return true; // dead, but this is not enough
-
-            case Instruction::Load:
-            {
-                LoadInst *li = dyn_cast<LoadInst>(&I);
-                if (li && li->isVolatile())
-                    return false;
-                return true;
-            }
-            default:
-                // any other opcode fails
-                return false;
+    std::vector<std::string> Inputs = collect_batch_inputs(Argv0);
+    std::vector<std::string> Outputs;
+    StringSet<> Seen;
+    for (const std::string &In : Inputs)
+    {
+        SmallString<256> OutPath(OutputDir);
+        sys::path::append(OutPath, sys::path::stem(In) + "-out.bc");
+        if (!Seen.insert(OutPath).second)
+        {
+            errs() << Argv0 << ": " << In << ": output " << OutPath << " would overwrite another input's output\n";
+            return 1;
         }
+        Outputs.push_back(std::string(OutPath));
     }
 
-    return false;
+    std::mutex PrintLock;
+    std::atomic<unsigned> Failed(0);
+    ThreadPool Pool(hardware_concurrency(Threads));
+    for (size_t i = 0; i < Inputs.size(); i++)
+    {
+        Pool.async([&, i]() {
+            std::string OutBuf, ErrBuf;
+            raw_string_ostream Out(OutBuf), Err(ErrBuf);
+            if (run_p2(Inputs[i], Outputs[i], Argv0, Out, Err))
+                Failed++;
+
+            std::lock_guard<std::mutex> Lock(PrintLock);
+            outs() << "** " << Inputs[i] << " -> " << Outputs[i] << "\n" << Out.str();
+            outs().flush();
+            errs() << Err.str();
+        });
+    }
+    Pool.wait();
+
+    return Failed ? 1 : 0;
 }
 
-bool cse_check_opcode(Instruction &I)
+/* Keep -cache-dir under -cache-size-mb. A thread that finds another one
+ * pruning has nothing to add and goes on. */
+static void prune_cache()
 {
-    bool mRetVal = true;
-    int opcode = I.getOpcode();
-    switch (opcode) {
-        case Instruction::Add:
-        case Instruction::FNeg:
-        case Instruction::FAdd:
-        case Instruction::Sub:
-        case Instruction::FSub:
-        case Instruction::Mul:
-        case Instruction::FMul:
-        case Instruction::UDiv:
-        case Instruction::SDiv:
-        case Instruction::FDiv:
-        case Instruction::URem:
-        case Instruction::SRem:
-        case Instruction::FRem:
-        case Instruction::Shl:
-        case Instruction::LShr:
-        case Instruction::AShr:
-        case Instruction::And:
-        case Instruction::Or:
-        case Instruction::Xor:
-        //case Instruction::GetElementPtr:
-        //case Instruction::ICmp:
-            mRetVal = true;
+    static std::mutex PruneLock;
+    if (CacheDir.empty())
+        return;
+    std::unique_lock<std::mutex> Lock(PruneLock, std::try_to_lock);
+    if (Lock.owns_lock())
+        CSECache::prune(CacheDir, (uint64_t)CacheSizeMB << 20);
+}
+
+/* Answer the requests of one client until it closes the stream. Every
+ * module gets a fresh LLVMContext and CSEContext from run_p2, so nothing,
+ * counters included, carries over from one request to the next. What run_p2
+ * prints besides the counters goes to stderr. */
+static void serve(int InFD, int OutFD, const char *Argv0, std::mutex &PrintLock)
+{
+    std::string Module;
+    while (cse_read_request(InFD, Module))
+    {
+        P2Buffers Buffers;
+        /* The IR parser needs the terminating null std::string has */
+        Buffers.Input = MemoryBuffer::getMemBuffer(Module, "<request>");
+        std::string OutBuf, ErrBuf;
+        raw_string_ostream Out(OutBuf), Err(ErrBuf);
+        bool Ok = !run_p2("<request>", "<response>", Argv0, Out, Err, &Buffers);
+
+        bool Sent = Ok ? cse_write_result(OutFD, StringRef(Buffers.Bitcode.data(), Buffers.Bitcode.size()),
+                                          Buffers.Stats)
+                       : cse_write_error(OutFD, Err.str());
+        if (Ok && !Err.str().empty())
+        {
+            std::lock_guard<std::mutex> Lock(PrintLock);
+            errs() << Err.str();
+        }
+        if (!Sent)
             break;
-        default:
-            mRetVal = false;
+        /* A server may never exit: keep -cache-dir small as it goes */
+        prune_cache();
+    }
+}
+
+/* -server: one client on stdin and stdout, or every client connecting to
+ * -socket, each served on a worker thread. Runs until stdin is closed or the
+ * process is killed. */
+static int run_server(const char *Argv0)
+{
+    /* A client going away must not end the server */
+    signal(SIGPIPE, SIG_IGN);
+    std::mutex PrintLock;
+    if (SocketPath.empty())
+    {
+        serve(0, 1, Argv0, PrintLock);
+        return 0;
+    }
+
+    std::string Error;
+    int Listen = cse_listen(SocketPath, Error);
+    if (Listen < 0)
+    {
+        errs() << Argv0 << ": " << SocketPath << ": " << Error << "\n";
+        return 1;
+    }
+    ThreadPool Pool(hardware_concurrency(Threads));
+    for (;;)
+    {
+        int FD = ::accept(Listen, nullptr, nullptr);
+        if (FD < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            errs() << Argv0 << ": " << SocketPath << ": " << strerror(errno) << "\n";
             break;
+        }
+        Pool.async([&, FD]() {
+            serve(FD, FD, Argv0, PrintLock);
+            ::close(FD);
+        });
     }
+    Pool.wait();
+    ::close(Listen);
+    return 1;
+}
 
-    if(I.isVolatile())
+int main(int argc, char **argv) {
+    // Parse command line arguments
+    cl::ParseCommandLineOptions(argc, argv, "llvm system compiler\n");
+
+    // Handle creating output files and shutting down properly
+    llvm_shutdown_obj Y;  // Call llvm_shutdown() on exit.
+
+    int Ret;
+    if (Parallel && !CacheDir.empty())
+    {
+        errs() << argv[0] << ": -parallel cannot be used with -cache-dir\n";
+        return 1;
+    }
+    if (Parallel && Remarks && RemarksFormat != "yaml")
     {
-        mRetVal = false;
+        errs() << argv[0] << ": -parallel writes -remarks only as yaml\n";
+        return 1;
     }
-    if(I.isTerminator() || I.isExceptionalTerminator() || I.isIndirectTerminator() || I.mayHaveSideEffects() || (!I.isSafeToRemove()))
+    if (Server && !Positionals.empty())
+    {
+        errs() << argv[0] << ": -server takes no inputs\n";
+        return 1;
+    }
+    else if (Server)
+        Ret = run_server(argv[0]);
+    else if (Batch && Positionals.empty())
+    {
+        errs() << argv[0] << ": -batch expects <inputs...>\n";
+        return 1;
+    }
+    else if (Batch)
+        Ret = run_batch(argv[0]);
+    else if (Positionals.size() != 2)
+    {
+        errs() << argv[0] << ": expected <input bitcode> <output bitcode>\n";
+        return 1;
+    }
+    else
+        Ret = run_p2(Positionals[0], Positionals[1], argv[0], outs(), errs());
+
+    prune_cache();
+    return Ret;
+}
+
+/* Is the first load or store of M a store? */
+static bool store_first(Module &M)
+{
+    for (Function &F : M)
     {
-        mRetVal = false;
+        for (BasicBlock &BB : F)
+        {
+            for (Instruction &I : BB)
+            {
+                if (isa<LoadInst>(I) || isa<StoreInst>(I))
+                    return isa<StoreInst>(I);
+            }
+        }
     }
-    //mRetVal = false;
-    return mRetVal;
+    return false;
+}
 
-}
\ No newline at end of file
+/* The Functions, Instructions, Loads and Stores counters. DCE counted what
+ * it saw as it went, see CSESummary; without it the module is counted
+ * here. Loads and Stores go to .stats in the order they first appear in the
+ * module, which only takes a walk up to the first of them. */
+static void summarize(Module *M, CSEContext &Ctx) {
+    CSEStatistics &S = Ctx.Stats;
+    CSESummary &Sum = Ctx.Summary;
+    if (NoCSE) {
+        for (Function &F : *M)
+            Sum.add(F);
+    }
+    bool StoreFirst = Sum.Loads && Sum.Stores && store_first(*M);
+    if (Sum.Functions)
+        S.nFunctions += Sum.Functions;
+    if (Sum.Instructions)
+        S.nInstructions += Sum.Instructions;
+    if (StoreFirst)
+        S.nStores += Sum.Stores;
+    if (Sum.Loads)
+        S.nLoads += Sum.Loads;
+    if (Sum.Stores && !StoreFirst)
+        S.nStores += Sum.Stores;
+}
+
+
+static void print_csv(raw_ostream &OS, CSEContext &Ctx)
+{
+    for (CSECounter *p : Ctx.Stats.Registered) {
+        OS << p->getName() << "," << p->getValue() << "\n";
+    }
+}
+
+static void print_csv_file(std::string outputfile, CSEContext &Ctx)
+{
+    std::error_code EC;
+    raw_fd_ostream stats(outputfile + ".stats", EC, sys::fs::OF_Text);
+    if (!EC)
+        print_csv(stats, Ctx);
+}
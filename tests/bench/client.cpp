@@ -0,0 +1,207 @@
+/* A client of p2 -server and its latency benchmark.
+ *
+ * Every input (an .ll or .bc file, or a directory of them) is sent -repeat
+ * times over one connection to -socket and the time from sending a module to
+ * having read its response is recorded. With -output-dir the optimized
+ * bitcode and the statistics of the last response go to
+ * <output dir>/<input>-out.bc and <input>-out.bc.stats, as p2 would write
+ * them.
+ *
+ * With -exec=<p2> the same inputs are optimized by starting p2 once per
+ * module instead, which is what the server saves.
+ *
+ * Count, p50, p99 and the maximum of the latencies are printed in ms. The
+ * exit code is 1 if a request failed.
+ * */
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "CSEServer.h"
+
+using namespace llvm;
+using namespace p2;
+
+static cl::list<std::string>
+        Inputs(cl::Positional, cl::desc("<inputs: .ll/.bc files or directories>"));
+
+static cl::opt<std::string>
+        SocketPath("socket", cl::desc("Unix socket of p2 -server."), cl::init("p2.sock"));
+
+static cl::opt<unsigned>
+        Repeat("repeat", cl::desc("Number of times each input is sent."), cl::init(1));
+
+static cl::opt<std::string>
+        OutputDir("output-dir", cl::desc("Write the responses to this directory."), cl::init(""));
+
+static cl::opt<std::string>
+        ExecPath("exec", cl::desc("Run this p2 once per module instead of using the server."), cl::init(""));
+
+namespace {
+
+/* Files named on the command line, and the .ll and .bc files directly in
+ * directories named there, sorted */
+std::vector<std::string> collect_inputs()
+{
+    std::vector<std::string> Files;
+    for (const std::string &P : Inputs) {
+        if (!sys::fs::is_directory(P)) {
+            Files.push_back(P);
+            continue;
+        }
+        std::vector<std::string> Found;
+        std::error_code EC;
+        for (sys::fs::directory_iterator I(P, EC), E; I != E && !EC; I.increment(EC)) {
+            StringRef Ext = sys::path::extension(I->path());
+            if ((Ext == ".ll" || Ext == ".bc") && !sys::fs::is_directory(I->path()))
+                Found.push_back(I->path());
+        }
+        std::sort(Found.begin(), Found.end());
+        Files.insert(Files.end(), Found.begin(), Found.end());
+    }
+    return Files;
+}
+
+std::string output_path(StringRef Dir, StringRef Input)
+{
+    SmallString<256> P(Dir);
+    sys::path::append(P, sys::path::stem(Input) + "-out.bc");
+    return std::string(P);
+}
+
+bool write_file(StringRef Path, StringRef Data)
+{
+    std::error_code EC;
+    raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+    if (EC) {
+        errs() << Path << ": " << EC.message() << "\n";
+        return false;
+    }
+    OS << Data;
+    return true;
+}
+
+double since(std::chrono::steady_clock::time_point Start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Start).count();
+}
+
+/* p2 <input> <output> as a new process */
+bool exec_one(const std::string &P2, const std::string &Input, const std::string &Output)
+{
+    StringRef Argv[] = {P2, Input, Output};
+    Optional<StringRef> Redirects[] = {StringRef(""), StringRef(""), None};
+    std::string Error;
+    int Status = sys::ExecuteAndWait(P2, Argv, None, Redirects, 0, 0, &Error);
+    if (Status != 0)
+        errs() << Input << ": " << (Error.empty() ? "p2 failed" : Error) << "\n";
+    return Status == 0;
+}
+
+/* Send Module and wait for the response */
+bool request(int FD, StringRef Input, StringRef Module, std::string &Bitcode, std::string &Stats)
+{
+    bool Ok;
+    if (!cse_write_request(FD, Module) || !cse_read_response(FD, Ok, Bitcode, Stats)) {
+        errs() << Input << ": connection to " << SocketPath << " lost\n";
+        return false;
+    }
+    if (!Ok)
+        errs() << Input << ": " << Stats;
+    return Ok;
+}
+
+/* The value below which a fraction P of the sorted latencies lie */
+double percentile(ArrayRef<double> Sorted, double P)
+{
+    size_t i = (size_t)(P * (Sorted.size() - 1) + 0.5);
+    return Sorted[std::min(i, Sorted.size() - 1)];
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, argv, "client and latency benchmark of p2 -server\n");
+
+    std::vector<std::string> Files = collect_inputs();
+    if (Files.empty()) {
+        errs() << argv[0] << ": no inputs\n";
+        return 1;
+    }
+    if (!OutputDir.empty()) {
+        if (std::error_code EC = sys::fs::create_directories(OutputDir)) {
+            errs() << argv[0] << ": " << OutputDir << ": " << EC.message() << "\n";
+            return 1;
+        }
+    }
+
+    int FD = -1;
+    std::string P2;
+    if (!ExecPath.empty()) {
+        ErrorOr<std::string> P = sys::findProgramByName(ExecPath);
+        P2 = P ? *P : std::string(ExecPath);
+    } else {
+        std::string Error;
+        FD = cse_connect(SocketPath, Error);
+        if (FD < 0) {
+            errs() << argv[0] << ": " << SocketPath << ": " << Error << "\n";
+            return 1;
+        }
+    }
+
+    /* Outputs of -exec that are not kept */
+    SmallString<128> Scratch;
+    if (!P2.empty() && OutputDir.empty())
+        sys::fs::createTemporaryFile("p2-client", "bc", Scratch);
+
+    bool Failed = false;
+    std::vector<double> Latencies;
+    for (const std::string &Input : Files) {
+        auto Buf = MemoryBuffer::getFile(Input, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+        if (!Buf) {
+            errs() << Input << ": " << Buf.getError().message() << "\n";
+            Failed = true;
+            continue;
+        }
+        std::string Output = OutputDir.empty() ? std::string(Scratch) : output_path(OutputDir, Input);
+        std::string Bitcode, Stats;
+        bool Ok = true;
+        for (unsigned r = 0; r < Repeat; r++) {
+            auto Start = std::chrono::steady_clock::now();
+            Ok = P2.empty() ? request(FD, Input, (*Buf)->getBuffer(), Bitcode, Stats)
+                 : exec_one(P2, Input, Output);
+            Latencies.push_back(since(Start));
+            if (!Ok)
+                break;
+        }
+        if (Ok && P2.empty() && !OutputDir.empty())
+            Ok = write_file(Output, Bitcode) && write_file(Output + ".stats", Stats);
+        Failed |= !Ok;
+    }
+    if (FD >= 0)
+        ::close(FD);
+    if (!Scratch.empty()) {
+        sys::fs::remove(Scratch);
+        sys::fs::remove(Scratch + ".stats");
+    }
+
+    if (!Latencies.empty()) {
+        std::sort(Latencies.begin(), Latencies.end());
+        outs() << (P2.empty() ? "server " : "exec   ")
+               << format("requests %6zu  p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n", Latencies.size(),
+                         percentile(Latencies, 0.5), percentile(Latencies, 0.99), Latencies.back());
+    }
+    return Failed ? 1 : 0;
+}
@@ -0,0 +1,387 @@
+/* Comparison of p2 with the matching opt pipelines on the same inputs.
+ *
+ * Every input (an .ll or .bc file, or a directory of them) is optimized by
+ * p2, by p2 with all of its optional phases and by opt with each -pipeline
+ * (early-cse, gvn, dse and all three by default). For each run the harness
+ * records
+ * ■	wall and user time and peak RSS of the process,
+ * ■	the counts of p2's summarize() on the output: functions, instructions,
+ *	loads and stores,
+ * ■	for inputs that define main, whether lli gives the same exit code and
+ *	output for the optimized module as for the input.
+ * The results of each input go to <work dir>/<input>.compare.json, to be
+ * tracked from one release to the next, and a table is printed. With -gen,
+ * synthetic modules of p2-gen (with a main) are added to the inputs.
+ *
+ * The exit code is 1 if a run failed or lli disagreed with the input.
+ * */
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+static cl::list<std::string>
+        Inputs(cl::Positional, cl::desc("<inputs: .ll/.bc files or directories>"));
+
+static cl::opt<std::string>
+        P2Path("p2", cl::desc("p2 executable."), cl::init("p2"));
+
+static cl::opt<std::string>
+        OptPath("opt", cl::desc("opt executable."), cl::init("opt"));
+
+static cl::opt<std::string>
+        LliPath("lli", cl::desc("lli executable."), cl::init("lli"));
+
+static cl::opt<std::string>
+        GenPath("gen", cl::desc("p2-gen executable; add synthetic modules to the inputs."), cl::init(""));
+
+static cl::opt<std::string>
+        WorkDir("work-dir", cl::desc("Directory for outputs and reports."), cl::init("."));
+
+static cl::list<std::string>
+        Pipelines("pipeline", cl::desc("opt pipeline to compare with (repeatable)."));
+
+static cl::opt<unsigned>
+        Timeout("timeout", cl::desc("Seconds after which a run is stopped."), cl::init(120));
+
+namespace {
+
+/* One way of optimizing an input */
+struct Config {
+    std::string Name;
+    std::string Program;
+    std::vector<std::string> Args;
+    bool IsP2;
+};
+
+/* What ExecuteAndWait reports. Status is negative when the program could
+ * not be run, crashed or timed out. */
+struct Measure {
+    int Status = -1;
+    double Wall = 0;
+    double User = 0;
+    uint64_t PeakRSSKB = 0;
+    std::string Error;
+};
+
+/* The counts of p2's summarize(), and whether lli can run the module */
+struct Summary {
+    bool Valid = false;
+    bool HasMain = false;
+    uint64_t Functions = 0;
+    uint64_t Instructions = 0;
+    uint64_t Loads = 0;
+    uint64_t Stores = 0;
+};
+
+/* Exit code and output of lli */
+struct Execution {
+    bool Ran = false;
+    int Status = 0;
+    std::string Output;
+};
+
+struct Result {
+    std::string Name;
+    std::string Output;
+    Measure M;
+    Summary S;
+    /* "same", "different", "failed" or "" when the input is not executable */
+    std::string Lli;
+};
+
+std::string find_program(StringRef Name)
+{
+    if (Name.contains('/'))
+        return std::string(Name);
+    ErrorOr<std::string> P = sys::findProgramByName(Name);
+    return P ? *P : std::string(Name);
+}
+
+Measure run(const std::string &Program, ArrayRef<std::string> Args, StringRef Stdout, StringRef Stderr)
+{
+    std::vector<StringRef> Argv{Program};
+    Argv.insert(Argv.end(), Args.begin(), Args.end());
+    Optional<StringRef> Redirects[] = {StringRef(""), Stdout, Stderr};
+    Optional<sys::ProcessStatistics> Stat;
+
+    Measure M;
+    auto Start = std::chrono::steady_clock::now();
+    M.Status = sys::ExecuteAndWait(Program, Argv, None, Redirects, Timeout, 0, &M.Error, nullptr, &Stat);
+    M.Wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - Start).count();
+    if (Stat) {
+        M.User = Stat->UserTime.count() / 1e6;
+        M.PeakRSSKB = Stat->PeakMemory;
+    }
+    return M;
+}
+
+/* Same counts as summarize() in p2 */
+Summary summarize(StringRef File)
+{
+    Summary S;
+    LLVMContext Context;
+    SMDiagnostic Diag;
+    std::unique_ptr<Module> M = parseIRFile(File, Diag, Context);
+    if (!M)
+        return S;
+    S.Valid = true;
+    Function *Main = M->getFunction("main");
+    S.HasMain = Main && !Main->isDeclaration();
+    for (Function &F : *M) {
+        if (!F.empty())
+            S.Functions++;
+        for (BasicBlock &BB : F) {
+            for (Instruction &I : BB) {
+                S.Instructions++;
+                if (isa<LoadInst>(I))
+                    S.Loads++;
+                else if (isa<StoreInst>(I))
+                    S.Stores++;
+            }
+        }
+    }
+    return S;
+}
+
+Execution execute(const std::string &Lli, StringRef File)
+{
+    Execution E;
+    std::string Out = (File + ".lli.out").str();
+    Measure M = run(Lli, {std::string(File)}, Out, (File + ".lli.err").str());
+    if (M.Status < 0)
+        return E;
+    auto Buf = MemoryBuffer::getFile(Out);
+    E.Ran = true;
+    E.Status = M.Status;
+    E.Output = Buf ? std::string((*Buf)->getBuffer()) : "";
+    return E;
+}
+
+/* Name, with every run of characters other than letters and digits made a
+ * single '-', as in early-cse-memssa-gvn-dse */
+std::string file_name(StringRef Name)
+{
+    std::string F;
+    for (char c : Name) {
+        if (isAlnum(c))
+            F += c;
+        else if (!F.empty() && F.back() != '-')
+            F += '-';
+    }
+    while (!F.empty() && F.back() == '-')
+        F.pop_back();
+    return F;
+}
+
+/* Files named on the command line, and the .ll and .bc files directly in
+ * directories named there, sorted */
+std::vector<std::string> collect_inputs()
+{
+    std::vector<std::string> Files;
+    for (const std::string &P : Inputs) {
+        if (!sys::fs::is_directory(P)) {
+            Files.push_back(P);
+            continue;
+        }
+        std::vector<std::string> Found;
+        std::error_code EC;
+        for (sys::fs::directory_iterator I(P, EC), E; I != E && !EC; I.increment(EC)) {
+            StringRef Ext = sys::path::extension(I->path());
+            if ((Ext == ".ll" || Ext == ".bc") && !sys::fs::is_directory(I->path()))
+                Found.push_back(I->path());
+        }
+        std::sort(Found.begin(), Found.end());
+        Files.insert(Files.end(), Found.begin(), Found.end());
+    }
+    return Files;
+}
+
+/* Synthetic modules from p2-gen; name: generator options */
+const char *Synthetic[] = {
+        "synthetic-small:-functions=3 -regions=10 -depth=2 -block-size=20",
+        "synthetic-mem:-functions=3 -regions=10 -depth=2 -block-size=40 -mem=0.5",
+        "synthetic-large:-functions=4 -regions=10 -depth=3 -block-size=100",
+};
+
+void print_report(StringRef Path, StringRef Input, const Summary &In, const Execution &InRun,
+                  ArrayRef<Result> Results)
+{
+    std::error_code EC;
+    raw_fd_ostream OS(Path, EC, sys::fs::OF_Text);
+    if (EC) {
+        errs() << Path << ": " << EC.message() << "\n";
+        return;
+    }
+    auto counts = [](json::OStream &J, const Summary &S) {
+        J.attribute("functions", (int64_t)S.Functions);
+        J.attribute("instructions", (int64_t)S.Instructions);
+        J.attribute("loads", (int64_t)S.Loads);
+        J.attribute("stores", (int64_t)S.Stores);
+    };
+
+    json::OStream J(OS, 2);
+    J.object([&] {
+        J.attribute("input", Input);
+        J.attributeObject("counts", [&] { counts(J, In); });
+        J.attribute("executable", InRun.Ran);
+        if (InRun.Ran)
+            J.attribute("exit_code", InRun.Status);
+        J.attributeArray("runs", [&] {
+            for (const Result &R : Results) {
+                J.object([&] {
+                    J.attribute("name", R.Name);
+                    J.attribute("output", R.Output);
+                    J.attribute("status", R.M.Status);
+                    J.attribute("wall", R.M.Wall);
+                    J.attribute("user", R.M.User);
+                    J.attribute("peak_rss_kb", (int64_t)R.M.PeakRSSKB);
+                    if (R.S.Valid)
+                        J.attributeObject("counts", [&] { counts(J, R.S); });
+                    if (!R.Lli.empty())
+                        J.attribute("lli", R.Lli);
+                });
+            }
+        });
+    });
+    OS << "\n";
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, argv, "compare p2 with opt's early-cse, gvn and dse\n");
+
+    if (std::error_code EC = sys::fs::create_directories(WorkDir)) {
+        errs() << argv[0] << ": " << WorkDir << ": " << EC.message() << "\n";
+        return 1;
+    }
+    std::string P2 = find_program(P2Path);
+    std::string Opt = find_program(OptPath);
+    std::string Lli = find_program(LliPath);
+
+    std::vector<Config> Configs = {
+            {"p2", P2, {}, true},
+            {"p2-all", P2, {"-global-loads", "-global-stores", "-hoist", "-licm"}, true},
+    };
+    std::vector<std::string> Passes(Pipelines.begin(), Pipelines.end());
+    if (Passes.empty())
+        Passes = {"early-cse", "early-cse<memssa>", "gvn", "dse", "early-cse<memssa>,gvn,dse"};
+    for (const std::string &P : Passes)
+        Configs.push_back({P, Opt, {"-passes=" + P}, false});
+
+    std::vector<std::string> Files = collect_inputs();
+    if (!GenPath.empty()) {
+        std::string Gen = find_program(GenPath);
+        for (StringRef Entry : Synthetic) {
+            auto NameFlags = Entry.split(':');
+            SmallString<256> File(WorkDir);
+            sys::path::append(File, NameFlags.first + ".bc");
+            std::vector<std::string> Args{std::string(File), "-main"};
+            SmallVector<StringRef, 8> Flags;
+            NameFlags.second.split(Flags, ' ', -1, false);
+            for (StringRef F : Flags)
+                Args.push_back(std::string(F));
+            Measure M = run(Gen, Args, "", "");
+            if (M.Status != 0) {
+                errs() << argv[0] << ": " << Gen << ": " << (M.Error.empty() ? "failed" : M.Error) << "\n";
+                return 1;
+            }
+            Files.push_back(std::string(File));
+        }
+    }
+    if (Files.empty()) {
+        errs() << argv[0] << ": no inputs\n";
+        return 1;
+    }
+
+    bool Failed = false;
+    StringSet<> Stems;
+    for (const std::string &Input : Files) {
+        /* Inputs of the same name from different directories */
+        std::string Stem = std::string(sys::path::stem(Input));
+        for (unsigned n = 1; !Stems.insert(Stem).second; n++)
+            Stem = (sys::path::stem(Input) + "." + Twine(n)).str();
+        auto work = [&](const Twine &Suffix) {
+            SmallString<256> P(WorkDir);
+            sys::path::append(P, Stem + Suffix);
+            return std::string(P);
+        };
+
+        Summary In = summarize(Input);
+        if (!In.Valid) {
+            errs() << argv[0] << ": " << Input << ": cannot be parsed\n";
+            Failed = true;
+            continue;
+        }
+        Execution InRun;
+        if (In.HasMain)
+            InRun = execute(Lli, Input);
+
+        std::vector<Result> Results;
+        for (const Config &C : Configs) {
+            Result R;
+            R.Name = C.Name;
+            R.Output = work("-" + file_name(C.Name) + ".bc");
+            std::vector<std::string> Args = C.Args;
+            if (C.IsP2) {
+                Args.push_back(Input);
+                Args.push_back(R.Output);
+            } else {
+                Args.insert(Args.end(), {Input, "-o", R.Output});
+            }
+            R.M = run(C.Program, Args, R.Output + ".log", R.Output + ".log");
+            if (R.M.Status != 0) {
+                Failed = true;
+            } else {
+                R.S = summarize(R.Output);
+                if (InRun.Ran) {
+                    Execution Out = execute(Lli, R.Output);
+                    if (!Out.Ran)
+                        R.Lli = "failed";
+                    else
+                        R.Lli = Out.Status == InRun.Status && Out.Output == InRun.Output ? "same" : "different";
+                    if (R.Lli != "same")
+                        Failed = true;
+                }
+            }
+            Results.push_back(std::move(R));
+        }
+        print_report(work(".compare.json"), Input, In, InRun, Results);
+
+        outs() << Input << (InRun.Ran ? "" : " (not executable)") << "\n";
+        outs() << "  run                            wall(s)    rss(KB)     insts   loads  stores  lli\n";
+        outs() << "  input" << format("%54" PRIu64 " %7" PRIu64 " %7" PRIu64 "\n", In.Instructions, In.Loads,
+                                      In.Stores);
+        for (const Result &R : Results) {
+            if (R.M.Status != 0) {
+                outs() << format("  %-28s failed (%d) %s, see %s.log\n", R.Name.c_str(), R.M.Status,
+                                 R.M.Error.c_str(), R.Output.c_str());
+                continue;
+            }
+            outs() << format("  %-28s %9.3f %10" PRIu64 " %9" PRIu64 " %7" PRIu64 " %7" PRIu64 "  %s\n",
+                             R.Name.c_str(), R.M.Wall, R.M.PeakRSSKB, R.S.Instructions, R.S.Loads,
+                             R.S.Stores, R.Lli.c_str());
+        }
+    }
+    return Failed ? 1 : 0;
+}
@@ -0,0 +1,161 @@
+/* Micro-benchmark for the dominance analysis shared by the phases of p2.
+ *
+ * Builds a synthetic function of diamonds (head, two arms, join), each block
+ * holding -block-size arithmetic instructions, and compares
+ * ■	recompute: a fresh DominatorTree for each of the three phases that used
+ *	to build one (intra-block pass, gDT and mDT in the dominator-child
+ *	pass), with DominatorTree::dominates queries;
+ * ■	shared: one CSEDominance for the whole function, with its O(1) queries;
+ * ■	linear: the same-block query answered by walking the block, which is
+ *	what an uncached instruction order costs.
+ * */
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "CSEDominance.h"
+
+using namespace llvm;
+
+static cl::opt<unsigned>
+        NumDiamonds("diamonds",
+                    cl::desc("Number of if/else diamonds in the function."),
+                    cl::init(1000));
+
+static cl::opt<unsigned>
+        BlockSize("block-size",
+                  cl::desc("Arithmetic instructions per basic block."),
+                  cl::init(100));
+
+static cl::opt<unsigned>
+        NumQueries("queries",
+                   cl::desc("Dominance queries per scheme."),
+                   cl::init(1000000));
+
+static Function *build_function(Module &M)
+{
+    LLVMContext &C = M.getContext();
+    Type *I32 = Type::getInt32Ty(C);
+    FunctionType *FT = FunctionType::get(I32, {I32, I32}, false);
+    Function *F = Function::Create(FT, Function::ExternalLinkage, "bench", M);
+    Value *A = F->getArg(0);
+    Value *B = F->getArg(1);
+
+    IRBuilder<> Builder(C);
+    BasicBlock *Head = BasicBlock::Create(C, "entry", F);
+    Value *Acc = A;
+    auto fill = [&](BasicBlock *BB) {
+        Builder.SetInsertPoint(BB);
+        for (unsigned i = 0; i < BlockSize; i++)
+            Acc = (i % 2) ? Builder.CreateAdd(Acc, B) : Builder.CreateMul(Acc, A);
+    };
+
+    for (unsigned d = 0; d < NumDiamonds; d++) {
+        BasicBlock *Then = BasicBlock::Create(C, "then", F);
+        BasicBlock *Else = BasicBlock::Create(C, "else", F);
+        BasicBlock *Join = BasicBlock::Create(C, "join", F);
+        fill(Head);
+        Value *Cond = Builder.CreateICmpSGT(Acc, B);
+        Builder.CreateCondBr(Cond, Then, Else);
+        Value *Base = Acc;
+        fill(Then);
+        Builder.CreateBr(Join);
+        Acc = Base;
+        fill(Else);
+        Builder.CreateBr(Join);
+        Acc = Base;
+        Head = Join;
+    }
+    fill(Head);
+    Builder.CreateRet(Acc);
+    return F;
+}
+
+static bool linear_comes_before(const Instruction *A, const Instruction *B)
+{
+    for (const Instruction &I : *A->getParent()) {
+        if (&I == A)
+            return true;
+        if (&I == B)
+            return false;
+    }
+    return false;
+}
+
+template <typename Fn> static double time_ms(Fn F)
+{
+    auto Start = std::chrono::steady_clock::now();
+    F();
+    auto End = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(End - Start).count();
+}
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, argv, "p2 dominance benchmark\n");
+
+    LLVMContext Context;
+    Module M("domtree-bench", Context);
+    Function *F = build_function(M);
+
+    std::vector<Instruction *> Insts;
+    for (BasicBlock &BB : *F)
+        for (Instruction &I : BB)
+            Insts.push_back(&I);
+
+    /* Half of the queries are within one block, half across blocks */
+    std::mt19937 Rng(466);
+    std::vector<std::pair<Instruction *, Instruction *>> Queries;
+    for (unsigned q = 0; q < NumQueries; q++) {
+        Instruction *I = Insts[Rng() % Insts.size()];
+        Instruction *J;
+        if (q % 2) {
+            BasicBlock *BB = I->getParent();
+            auto It = BB->begin();
+            std::advance(It, Rng() % BB->size());
+            J = &*It;
+        } else {
+            J = Insts[Rng() % Insts.size()];
+        }
+        Queries.push_back({I, J});
+    }
+
+    unsigned Dominated = 0;
+    double Recompute = time_ms([&]() {
+        DominatorTree DT;
+        for (int Phase = 0; Phase < 3; Phase++)
+            DT.recalculate(*F);
+        for (auto &Q : Queries)
+            Dominated += DT.dominates(Q.first, Q.second);
+    });
+
+    unsigned SharedDominated = 0;
+    double Shared = time_ms([&]() {
+        CSEDominance Dom;
+        for (int Phase = 0; Phase < 3; Phase++)
+            Dom.get(*F);
+        for (auto &Q : Queries)
+            SharedDominated += Dom.dominates(Q.first, Q.second);
+    });
+
+    unsigned LinearDominated = 0;
+    double Linear = time_ms([&]() {
+        for (auto &Q : Queries)
+            if (Q.first->getParent() == Q.second->getParent())
+                LinearDominated += Q.first != Q.second && linear_comes_before(Q.first, Q.second);
+    });
+
+    outs() << "blocks " << F->size() << ", instructions " << Insts.size()
+           << ", queries " << Queries.size() << "\n";
+    outs() << format("recompute  %10.2f ms  (3 trees, %u dominated)\n", Recompute, Dominated);
+    outs() << format("shared     %10.2f ms  (1 tree, %u dominated)\n", Shared, SharedDominated);
+    outs() << format("linear     %10.2f ms  (same-block queries only, %u dominated)\n", Linear, LinearDominated);
+    return 0;
+}
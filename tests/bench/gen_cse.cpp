@@ -0,0 +1,259 @@
+/* Generator of synthetic modules for scaling p2.
+ *
+ * Every function is a sequence of -regions regions. A region of depth d is a
+ * single block for d = 0, otherwise a head block branching to two regions of
+ * depth d-1 that meet again in a join block with a phi. Each block holds
+ * -block-size instructions:
+ * ■	with probability -mem a load from or a store to one of the function's
+ *	stack slots,
+ * ■	with probability -redundancy an exact copy of an expression computed in
+ *	a dominating block (a CSE candidate),
+ * ■	otherwise a new integer expression over values that dominate the block.
+ * Expressions chain through the most recent value, so almost nothing is dead
+ * on arrival and the work left for p2 is the redundancy.
+ *
+ * With -main the module also gets a main that calls every function, so lli
+ * can run it before and after optimization.
+ * */
+#include <random>
+#include <vector>
+
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+static cl::opt<std::string>
+        OutputFilename(cl::Positional, cl::desc("<output .ll or .bc>"), cl::Required);
+
+static cl::opt<unsigned>
+        NumFunctions("functions", cl::desc("Number of functions."), cl::init(1));
+
+static cl::opt<unsigned>
+        NumRegions("regions", cl::desc("Regions in sequence per function."), cl::init(10));
+
+static cl::opt<unsigned>
+        Depth("depth", cl::desc("If/else nesting depth of every region (CFG depth)."), cl::init(1));
+
+static cl::opt<unsigned>
+        BlockSize("block-size", cl::desc("Instructions per basic block."), cl::init(100));
+
+static cl::opt<double>
+        Redundancy("redundancy", cl::desc("Share of instructions that repeat a dominating expression."), cl::init(0.3));
+
+static cl::opt<double>
+        MemShare("mem", cl::desc("Share of instructions that are loads or stores."), cl::init(0.2));
+
+static cl::opt<unsigned>
+        NumSlots("slots", cl::desc("Stack slots per function used by loads and stores."), cl::init(8));
+
+static cl::opt<bool>
+        WithMain("main", cl::desc("Add a main calling every function, whose exit code depends on all results."),
+                 cl::init(false));
+
+static cl::opt<unsigned>
+        Seed("seed", cl::desc("Random seed."), cl::init(566));
+
+namespace {
+
+struct Expr {
+    Instruction::BinaryOps Opcode;
+    Value *LHS;
+    Value *RHS;
+};
+
+/* Values and expressions available in the block being filled. Entering a
+ * region arm saves the sizes, leaving it restores them, so only what
+ * dominates the current block is ever used. */
+struct Scope {
+    std::vector<Value *> Values;
+    std::vector<Expr> Exprs;
+};
+
+class Generator {
+public:
+    Generator(Module &M) : M(M), C(M.getContext()), B(C), Rng(Seed) {}
+
+    void function(unsigned N)
+    {
+        Type *I32 = Type::getInt32Ty(C);
+        FunctionType *FT = FunctionType::get(I32, {I32, I32, I32->getPointerTo()}, false);
+        F = Function::Create(FT, Function::ExternalLinkage, "f" + Twine(N), M);
+
+        BasicBlock *Entry = BasicBlock::Create(C, "entry", F);
+        B.SetInsertPoint(Entry);
+        Slots.clear();
+        for (unsigned s = 0; s < NumSlots; s++) {
+            AllocaInst *A = B.CreateAlloca(I32);
+            B.CreateStore(F->getArg(s % 2), A);
+            Slots.push_back(A);
+        }
+        S.Values = {F->getArg(0), F->getArg(1)};
+        S.Exprs.clear();
+        Last = F->getArg(0);
+
+        for (unsigned r = 0; r < NumRegions; r++)
+            region(Depth);
+
+        /* Make the stack slots observable */
+        B.CreateStore(B.CreateLoad(I32, Slots[0]), F->getArg(2));
+        B.CreateRet(Last);
+    }
+
+    /* main: call each of the first N functions with a few argument pairs and
+     * return a mix of what they returned and stored, within an exit code */
+    void driver(unsigned N)
+    {
+        static const int Args[][2] = {{3, 5}, {-7, 11}, {100, -3}};
+        Type *I32 = Type::getInt32Ty(C);
+        Function *Main = Function::Create(FunctionType::get(I32, false), Function::ExternalLinkage, "main", M);
+        B.SetInsertPoint(BasicBlock::Create(C, "entry", Main));
+        AllocaInst *Out = B.CreateAlloca(I32);
+        Value *Acc = B.getInt32(0);
+        for (unsigned f = 0; f < N; f++) {
+            for (auto &A : Args) {
+                Value *R = B.CreateCall(M.getFunction(("f" + Twine(f)).str()),
+                                        {B.getInt32(A[0]), B.getInt32(A[1]), Out});
+                Acc = B.CreateAdd(Acc, B.CreateXor(R, B.CreateLoad(I32, Out)));
+            }
+        }
+        B.CreateRet(B.CreateURem(Acc, B.getInt32(251)));
+    }
+
+private:
+    Module &M;
+    LLVMContext &C;
+    IRBuilder<> B;
+    std::mt19937 Rng;
+    Function *F = nullptr;
+    std::vector<AllocaInst *> Slots;
+    Scope S;
+    Value *Last = nullptr;
+
+    bool chance(double P) { return std::uniform_real_distribution<double>(0, 1)(Rng) < P; }
+    unsigned pick(size_t N) { return Rng() % N; }
+
+    /* A dominating value other than Last, so that no expression folds to a
+     * constant right away */
+    Value *operand()
+    {
+        Value *V = S.Values[pick(S.Values.size())];
+        if (V == Last)
+            return ConstantInt::get(Type::getInt32Ty(C), 1 + pick(1000));
+        return V;
+    }
+
+    void fill()
+    {
+        static const Instruction::BinaryOps Ops[] = {
+                Instruction::Add, Instruction::Sub, Instruction::Mul,
+                Instruction::And, Instruction::Or, Instruction::Xor};
+        Type *I32 = Type::getInt32Ty(C);
+
+        for (unsigned i = 0; i < BlockSize; i++) {
+            if (chance(MemShare)) {
+                AllocaInst *Slot = Slots[pick(Slots.size())];
+                if (chance(0.5)) {
+                    Last = B.CreateLoad(I32, Slot);
+                    S.Values.push_back(Last);
+                } else {
+                    B.CreateStore(Last, Slot);
+                }
+                continue;
+            }
+            if (!S.Exprs.empty() && chance(Redundancy)) {
+                Expr &E = S.Exprs[pick(S.Exprs.size())];
+                Last = B.CreateBinOp(E.Opcode, E.LHS, E.RHS);
+                S.Values.push_back(Last);
+                continue;
+            }
+            Expr E = {Ops[pick(6)], Last, operand()};
+            Last = B.CreateBinOp(E.Opcode, E.LHS, E.RHS);
+            S.Values.push_back(Last);
+            S.Exprs.push_back(E);
+        }
+    }
+
+    void region(unsigned D)
+    {
+        fill();
+        if (D == 0)
+            return;
+
+        BasicBlock *Then = BasicBlock::Create(C, "then", F);
+        BasicBlock *Else = BasicBlock::Create(C, "else", F);
+        BasicBlock *Join = BasicBlock::Create(C, "join", F);
+        B.CreateCondBr(B.CreateICmpSLT(Last, operand()), Then, Else);
+
+        size_t NumValues = S.Values.size(), NumExprs = S.Exprs.size();
+        Value *Base = Last;
+
+        B.SetInsertPoint(Then);
+        region(D - 1);
+        Value *ThenLast = Last;
+        BasicBlock *ThenEnd = B.GetInsertBlock();
+        B.CreateBr(Join);
+        S.Values.resize(NumValues);
+        S.Exprs.resize(NumExprs);
+
+        Last = Base;
+        B.SetInsertPoint(Else);
+        region(D - 1);
+        Value *ElseLast = Last;
+        BasicBlock *ElseEnd = B.GetInsertBlock();
+        B.CreateBr(Join);
+        S.Values.resize(NumValues);
+        S.Exprs.resize(NumExprs);
+
+        B.SetInsertPoint(Join);
+        PHINode *Phi = B.CreatePHI(ThenLast->getType(), 2);
+        Phi->addIncoming(ThenLast, ThenEnd);
+        Phi->addIncoming(ElseLast, ElseEnd);
+        Last = Phi;
+        S.Values.push_back(Phi);
+    }
+};
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, argv, "synthetic module generator for p2\n");
+
+    LLVMContext Context;
+    Module M("gen_cse", Context);
+    Generator G(M);
+    for (unsigned f = 0; f < NumFunctions; f++)
+        G.function(f);
+    if (WithMain)
+        G.driver(NumFunctions);
+
+    if (verifyModule(M, &errs()))
+        return 1;
+
+    std::error_code EC;
+    ToolOutputFile Out(OutputFilename, EC, sys::fs::OF_None);
+    if (EC) {
+        errs() << argv[0] << ": " << OutputFilename << ": " << EC.message() << "\n";
+        return 1;
+    }
+    if (sys::path::extension(OutputFilename) == ".ll")
+        M.print(Out.os(), nullptr);
+    else
+        WriteBitcodeToFile(M, Out.os());
+    Out.keep();
+
+    unsigned NumInsts = 0;
+    for (Function &F : M)
+        NumInsts += F.getInstructionCount();
+    outs() << OutputFilename << ": " << NumInsts << " instructions\n";
+    return 0;
+}
@@ -0,0 +1,50 @@
+#!/bin/bash
+# Cost of the remark hook of p2. DCE and CSE time on synthetic modules with
+# the hook compiled out (P2_NO_REMARKS), with remarks off, and with -remarks
+# as YAML and as bitstream. The best of several runs is shown, in seconds.
+#
+#   remarks.sh <p2-gen> <p2> <p2 built with P2_NO_REMARKS> [work dir] [runs]
+set -e
+
+GEN=$1
+P2=$2
+P2_NO_REMARKS=$3
+WORK=${4:-.}
+RUNS=${5:-5}
+mkdir -p "$WORK"
+
+# name: generator options
+SIZES=(
+    "100k:-functions=10 -regions=10 -depth=0 -block-size=1000"
+    "100k-cfg:-functions=10 -regions=10 -depth=3 -block-size=64"
+    "1M:-functions=10 -regions=25 -depth=2 -block-size=570"
+)
+
+# Best DCE + CSE wall time of RUNS runs of p2 <options...>
+best() {
+    local in=$1 out=$2 t
+    shift 2
+    for r in $(seq 1 "$RUNS"); do
+        "$@" -time-phases "$in" "$out" 2>"$out.time" >/dev/null
+        awk '/Dead code elimination$|Common subexpression elimination$/ {
+                 line = $0; gsub(/\([^)]*\)/, "", line); split(line, f, " "); t += f[4] }
+             END { print t }' "$out.time"
+    done | sort -g | head -1
+}
+
+printf "%-10s %10s %12s %12s %12s %12s %10s\n" \
+    size insts compiled-out off yaml bitstream remarks
+for entry in "${SIZES[@]}"; do
+    name=${entry%%:*}
+    flags=${entry#*:}
+    in="$WORK/remarks-$name.bc"
+    out="$WORK/remarks-$name-out.bc"
+    insts=$("$GEN" "$in" $flags | awk '{print $(NF-1)}')
+    none=$(best "$in" "$out" "$P2_NO_REMARKS")
+    off=$(best "$in" "$out" "$P2")
+    yaml=$(best "$in" "$out" "$P2" -remarks)
+    count=$(grep -c '^--- !Passed' "$out.opt.yaml" || true)
+    bitstream=$(best "$in" "$out" "$P2" -remarks -remarks-format=bitstream)
+    printf "%-10s %10s %12s %12s %12s %12s %10s\n" \
+        "$name" "$insts" "$none" "$off" "$yaml" "$bitstream" "$count"
+done
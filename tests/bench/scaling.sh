@@ -0,0 +1,51 @@
+#!/bin/bash
+# Scaling benchmark for p2: generate synthetic modules from about 1k to 1M
+# instructions and report the wall time of each p2 phase and the peak RSS.
+#
+#   scaling.sh <p2-gen> <p2> [work dir] [extra p2 options...]
+#
+# Extra generator options can be passed in GEN_FLAGS, e.g.
+#   GEN_FLAGS="-mem=0.5 -redundancy=0.6" scaling.sh ...
+set -e
+
+GEN=$1
+P2=$2
+WORK=${3:-.}
+shift 3 || shift $#
+mkdir -p "$WORK"
+
+# name: generator options (functions x regions x blocks per region x block size)
+SIZES=(
+    "1k:-functions=1 -regions=10 -depth=0 -block-size=100"
+    "10k-flat:-functions=1 -regions=1 -depth=0 -block-size=10000"
+    "10k:-functions=1 -regions=10 -depth=0 -block-size=1000"
+    "100k:-functions=10 -regions=10 -depth=0 -block-size=1000"
+    "100k-cfg:-functions=10 -regions=10 -depth=3 -block-size=64"
+    "1M:-functions=10 -regions=25 -depth=2 -block-size=570"
+)
+
+printf "%-10s %10s %9s %9s %9s %9s %9s %9s %10s\n" \
+    size insts parse dce cse verify write total "rss(KB)"
+for entry in "${SIZES[@]}"; do
+    name=${entry%%:*}
+    flags=${entry#*:}
+    in="$WORK/scaling-$name.bc"
+    out="$WORK/scaling-$name-out.bc"
+    insts=$("$GEN" "$in" $flags $GEN_FLAGS | awk '{print $(NF-1)}')
+    "$P2" -time-phases "$@" "$in" "$out" 2>"$WORK/scaling-$name.time" >/dev/null
+    # Wall time is the 4th number once the percentages are stripped
+    awk -v name="$name" -v insts="$insts" '
+        / Total$/ || /input$/ || /elimination$/ || /module$/ || /bitcode$/ {
+            line = $0; gsub(/\([^)]*\)/, "", line); split(line, f, " ");
+            if (line ~ /Parse input/) parse = f[4];
+            else if (line ~ /Dead code/) dce = f[4];
+            else if (line ~ /Common subexpression/) cse = f[4];
+            else if (line ~ /Verify module/) verify = f[4];
+            else if (line ~ /Write bitcode/) write = f[4];
+            else if (line ~ / Total$/) total = f[4];
+        }
+        /^Peak RSS:/ { rss = $3 }
+        END { printf "%-10s %10s %9s %9s %9s %9s %9s %9s %10s\n",
+                     name, insts, parse, dce, cse, verify, write, total, rss }
+    ' "$WORK/scaling-$name.time"
+done
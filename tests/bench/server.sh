@@ -0,0 +1,30 @@
+#!/bin/bash
+# Latency benchmark of p2 -server: many small modules sent to a warm server
+# over its Unix socket, against starting p2 once per module.
+#
+#   server.sh <p2-gen> <p2> <p2-client> [work dir] [repeat]
+set -e
+
+GEN=$1
+P2=$2
+CLIENT=$3
+WORK=${4:-.}
+REPEAT=${5:-10}
+mkdir -p "$WORK/modules"
+
+for i in $(seq 1 100); do
+    "$GEN" "$WORK/modules/m$i.bc" -seed=$i -functions=2 -regions=4 -depth=1 -block-size=20 >/dev/null
+done
+
+SOCK="$WORK/p2.sock"
+rm -f "$SOCK"
+"$P2" -server -socket="$SOCK" &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null' EXIT
+for i in $(seq 1 50); do
+    [ -S "$SOCK" ] && break
+    sleep 0.1
+done
+
+"$CLIENT" -socket="$SOCK" -repeat="$REPEAT" "$WORK/modules"
+"$CLIENT" -exec="$P2" "$WORK/modules"
@@ -0,0 +1,56 @@
+; ModuleID = 'cse10'
+; CHECK-LABEL: source_filename = "cse10"
+source_filename = "cse10"
+
+declare void @clobber(i32*)
+
+; A load of %1 in the entry block makes the loads in both branches and at the
+; join redundant. The store to the alloca cannot change %1. The store to %2
+; may, but comes first; it is forwarded to the load of %2 in the join. The
+; call may change both %1 and the alloca, so the loads after it are kept.
+; CHECK-LABEL: i32 @cse10(i1 %0, i32* %1, i32* %2, i32 %3)
+define i32 @cse10(i1 %0, i32* %1, i32* %2, i32 %3) {
+; CHECK-NEXT: BB
+; CHECK-NEXT: alloca
+; CHECK-NEXT: store
+; CHECK-NEXT: load i32, i32* %1
+; CHECK-NEXT: store
+; CHECK-NEXT: br
+; CHECK-NOT: load
+; CHECK: call void @clobber
+; CHECK-NEXT: load i32, i32* %1
+; CHECK-NEXT: add
+; CHECK-NEXT: load i32, i32* %A
+; CHECK-NOT: load
+; CHECK: ret i32
+BB:
+  %A = alloca i32, align 4
+  store i32 %3, i32* %2, align 4
+  %L = load i32, i32* %1, align 4
+  store i32 %3, i32* %A, align 4
+  br i1 %0, label %T, label %F
+
+T:
+  %LT = load i32, i32* %1, align 4
+  %AT = add i32 %LT, 1
+  br label %J
+
+F:
+  %LF = load i32, i32* %1, align 4
+  %AF = add i32 %LF, 2
+  br label %J
+
+J:
+  %P = phi i32 [ %AT, %T ], [ %AF, %F ]
+  %LJ = load i32, i32* %1, align 4
+  %S = load i32, i32* %2, align 4
+  %X = add i32 %LJ, %S
+  call void @clobber(i32* %A)
+  %LC = load i32, i32* %1, align 4
+  %Y = add i32 %X, %LC
+  %LA = load i32, i32* %A, align 4
+  %Z = add i32 %Y, %LA
+  %W = add i32 %Z, %P
+  %R = add i32 %W, %L
+  ret i32 %R
+}
@@ -0,0 +1,45 @@
+; ModuleID = 'cse11'
+; CHECK-LABEL: source_filename = "cse11"
+source_filename = "cse11"
+
+declare void @observe(i32*) argmemonly readonly nounwind
+
+; The store to %1 in the loop body is overwritten in the latch on every
+; path, and nothing in either branch reads %1: it is not an alias of %2.
+; The store to %2 is read in one branch and is kept.
+; CHECK-LABEL: void @cse11(i1 %0, i32* noalias %1, i32* %2, i32 %3)
+define void @cse11(i1 %0, i32* noalias %1, i32* %2, i32 %3) {
+; CHECK: Loop:
+; CHECK-NEXT: phi
+; CHECK-NEXT: add
+; CHECK-NEXT: store i32 %I, i32* %2
+; CHECK-NEXT: br
+; CHECK: store i32 %I, i32* %1
+; CHECK-NOT: store i32 %I, i32* %1
+; CHECK: ret void
+BB:
+  br label %Loop
+
+Loop:
+  %I = phi i32 [ 0, %BB ], [ %N, %Latch ]
+  %N = add i32 %I, 1
+  store i32 %3, i32* %1, align 4
+  store i32 %I, i32* %2, align 4
+  br i1 %0, label %T, label %F
+
+T:
+  call void @observe(i32* %2)
+  br label %Latch
+
+F:
+  store i32 %N, i32* %2, align 4
+  br label %Latch
+
+Latch:
+  store i32 %I, i32* %1, align 4
+  %C = icmp slt i32 %N, %3
+  br i1 %C, label %Loop, label %Exit
+
+Exit:
+  ret void
+}
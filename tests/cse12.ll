@@ -0,0 +1,43 @@
+; ModuleID = 'cse12'
+; CHECK-LABEL: source_filename = "cse12"
+source_filename = "cse12"
+
+; The value stored in the entry block is forwarded to the loads at the start
+; of both branches, which the entry block dominates. The load after the join
+; is kept: the join has two predecessors and %1 is stored to on one path.
+; CHECK-LABEL: i32 @cse12(i1 %0, i32* %1, i32 %2)
+define i32 @cse12(i1 %0, i32* %1, i32 %2) {
+; CHECK-NEXT: BB
+; CHECK-NEXT: store i32 %2, i32* %1
+; CHECK-NEXT: br
+; CHECK: T:
+; CHECK-NEXT: add i32 %2, 1
+; CHECK-NEXT: store
+; CHECK-NEXT: br
+; CHECK: F:
+; CHECK-NEXT: mul i32 %2, 3
+; CHECK-NEXT: br
+; CHECK: J:
+; CHECK-NEXT: phi
+; CHECK-NEXT: load i32, i32* %1
+BB:
+  store i32 %2, i32* %1, align 4
+  br i1 %0, label %T, label %F
+
+T:
+  %LT = load i32, i32* %1, align 4
+  %AT = add i32 %LT, 1
+  store i32 %AT, i32* %1, align 4
+  br label %J
+
+F:
+  %LF = load i32, i32* %1, align 4
+  %AF = mul i32 %LF, 3
+  br label %J
+
+J:
+  %P = phi i32 [ %AT, %T ], [ %AF, %F ]
+  %LJ = load i32, i32* %1, align 4
+  %R = add i32 %P, %LJ
+  ret i32 %R
+}
@@ -0,0 +1,48 @@
+; ModuleID = 'cse13'
+; CHECK-LABEL: source_filename = "cse13"
+source_filename = "cse13"
+
+; Every second instruction repeats the one before it: with commuted operands,
+; as a compare with swapped operands and predicate, or as the same GEP,
+; cast or select.
+; CHECK-LABEL: i64 @cse13(i32* %0, i32 %1, i32 %2, i64 %3)
+define i64 @cse13(i32* %0, i32 %1, i32 %2, i64 %3) {
+; CHECK-NEXT: BB
+; CHECK-NEXT: %A1 = add i32 %1, %2
+; CHECK-NEXT: %M1 = mul i32 %1, %2
+; CHECK-NEXT: %C1 = icmp slt i32 %1, %2
+; CHECK-NEXT: %G1 = getelementptr i32, i32* %0, i64 %3
+; CHECK-NEXT: %E1 = sext i32 %1 to i64
+; CHECK-NEXT: %S1 = select i1 %C1, i32 %A1, i32 %M1
+; CHECK-NEXT: %Z1 = zext i32 %S1 to i64
+; CHECK-NEXT: %P1 = ptrtoint i32* %G1 to i64
+; CHECK-NEXT: %R1 = mul i64 %Z1, %Z1
+; CHECK-NEXT: %R2 = mul i64 %P1, %P1
+; CHECK-NEXT: %R3 = mul i64 %E1, %E1
+; CHECK-NEXT: %R4 = add i64 %R1, %R2
+; CHECK-NEXT: %R5 = add i64 %R4, %R3
+; CHECK-NEXT: ret i64 %R5
+BB:
+  %A1 = add i32 %1, %2
+  %A2 = add i32 %2, %1
+  %M1 = mul i32 %1, %2
+  %M2 = mul i32 %2, %1
+  %C1 = icmp slt i32 %1, %2
+  %C2 = icmp sgt i32 %2, %1
+  %G1 = getelementptr i32, i32* %0, i64 %3
+  %G2 = getelementptr i32, i32* %0, i64 %3
+  %E1 = sext i32 %1 to i64
+  %E2 = sext i32 %1 to i64
+  %S1 = select i1 %C1, i32 %A1, i32 %M1
+  %S2 = select i1 %C2, i32 %A2, i32 %M2
+  %Z1 = zext i32 %S1 to i64
+  %Z2 = zext i32 %S2 to i64
+  %P1 = ptrtoint i32* %G1 to i64
+  %P2 = ptrtoint i32* %G2 to i64
+  %R1 = mul i64 %Z1, %Z2
+  %R2 = mul i64 %P1, %P2
+  %R3 = mul i64 %E1, %E2
+  %R4 = add i64 %R1, %R2
+  %R5 = add i64 %R4, %R3
+  ret i64 %R5
+}
@@ -0,0 +1,52 @@
+; ModuleID = 'cse14'
+; CHECK-LABEL: source_filename = "cse14"
+source_filename = "cse14"
+
+declare double @llvm.sqrt.f64(double)
+declare i32 @llvm.ctpop.i32(i32)
+declare i32 @hash(i32) readnone
+declare i32 @peek(i32*) readonly
+
+; Calls to intrinsics and readnone functions with the same arguments are
+; merged anywhere they dominate each other. The readonly call is merged
+; with the one before it, but not with the one after the store.
+; CHECK-LABEL: double @cse14(i1 %0, double %1, i32 %2, i32* %3)
+define double @cse14(i1 %0, double %1, i32 %2, i32* %3) {
+; CHECK-NEXT: BB
+; CHECK-NEXT: call double @llvm.sqrt.f64(double %1)
+; CHECK-NEXT: call i32 @llvm.ctpop.i32(i32 %2)
+; CHECK-NEXT: call i32 @hash(i32 %2)
+; CHECK-NEXT: call i32 @peek(i32* %3)
+; CHECK-NOT: call
+; CHECK: store
+; CHECK-NEXT: call i32 @peek(i32* %3)
+; CHECK-NOT: call
+; CHECK: ret double
+BB:
+  %S1 = call double @llvm.sqrt.f64(double %1)
+  %P1 = call i32 @llvm.ctpop.i32(i32 %2)
+  %H1 = call i32 @hash(i32 %2)
+  %R1 = call i32 @peek(i32* %3)
+  %R2 = call i32 @peek(i32* %3)
+  br i1 %0, label %T, label %J
+
+T:
+  %S2 = call double @llvm.sqrt.f64(double %1)
+  %P2 = call i32 @llvm.ctpop.i32(i32 %2)
+  %H2 = call i32 @hash(i32 %2)
+  %A = add i32 %P2, %H2
+  %B = add i32 %A, %R2
+  %F = sitofp i32 %B to double
+  %D = fadd double %S2, %F
+  br label %J
+
+J:
+  %X = phi double [ %D, %T ], [ %S1, %BB ]
+  %Y = add i32 %P1, %H1
+  %Z = add i32 %Y, %R1
+  store i32 %Z, i32* %3, align 4
+  %R3 = call i32 @peek(i32* %3)
+  %G = sitofp i32 %R3 to double
+  %R = fadd double %X, %G
+  ret double %R
+}
@@ -0,0 +1,32 @@
+; ModuleID = 'cse15'
+; CHECK-LABEL: source_filename = "cse15"
+source_filename = "cse15"
+
+; Repeated extracts, inserts and shuffles of the same vectors are merged.
+; The two shuffles of %0 and %1 with different masks are both kept.
+; CHECK-LABEL: <4 x i32> @cse15(<4 x i32> %0, <4 x i32> %1, i32 %2)
+define <4 x i32> @cse15(<4 x i32> %0, <4 x i32> %1, i32 %2) {
+; CHECK-NEXT: BB
+; CHECK-NEXT: %E1 = extractelement <4 x i32> %0, i32 1
+; CHECK-NEXT: %I1 = insertelement <4 x i32> %1, i32 %2, i32 0
+; CHECK-NEXT: %S1 = shufflevector <4 x i32> %0, <4 x i32> %I1, <4 x i32> <i32 0, i32 5, i32 2, i32 7>
+; CHECK-NEXT: %S3 = shufflevector <4 x i32> %0, <4 x i32> %I1, <4 x i32> <i32 4, i32 1, i32 6, i32 3>
+; CHECK-NEXT: %E3 = add i32 %E1, %E1
+; CHECK-NEXT: %X = insertelement <4 x i32> %S1, i32 %E3, i32 3
+; CHECK-NEXT: %Y = add <4 x i32> %X, %S1
+; CHECK-NEXT: %Z = add <4 x i32> %Y, %S3
+; CHECK-NEXT: ret <4 x i32> %Z
+BB:
+  %E1 = extractelement <4 x i32> %0, i32 1
+  %E2 = extractelement <4 x i32> %0, i32 1
+  %I1 = insertelement <4 x i32> %1, i32 %2, i32 0
+  %I2 = insertelement <4 x i32> %1, i32 %2, i32 0
+  %S1 = shufflevector <4 x i32> %0, <4 x i32> %I1, <4 x i32> <i32 0, i32 5, i32 2, i32 7>
+  %S2 = shufflevector <4 x i32> %0, <4 x i32> %I2, <4 x i32> <i32 0, i32 5, i32 2, i32 7>
+  %S3 = shufflevector <4 x i32> %0, <4 x i32> %I2, <4 x i32> <i32 4, i32 1, i32 6, i32 3>
+  %E3 = add i32 %E1, %E2
+  %X = insertelement <4 x i32> %S2, i32 %E3, i32 3
+  %Y = add <4 x i32> %X, %S1
+  %Z = add <4 x i32> %Y, %S3
+  ret <4 x i32> %Z
+}
@@ -0,0 +1,71 @@
+; ModuleID = 'cse16'
+; CHECK-LABEL: source_filename = "cse16"
+source_filename = "cse16"
+
+; The add and the shl are computed on both sides of the branch and move
+; above it; the shl only once the add has. The copy in the join block is
+; then redundant. The udiv may trap and stays where it is.
+; CHECK-LABEL: i32 @cse16(i1 %0, i32 %1, i32 %2)
+define i32 @cse16(i1 %0, i32 %1, i32 %2) {
+; CHECK-NEXT: BB
+; CHECK-NEXT: add i32 %1, %2
+; CHECK-NEXT: shl i32
+; CHECK-NEXT: br i1 %0
+; CHECK: T:
+; CHECK-NOT: add
+; CHECK-NOT: shl
+; CHECK: udiv
+; CHECK: F:
+; CHECK-NOT: add
+; CHECK-NOT: shl
+; CHECK: udiv
+; CHECK: J:
+; CHECK-NOT: add i32 %1, %2
+; CHECK: ret i32
+BB:
+  br i1 %0, label %T, label %F
+
+T:
+  %A1 = add i32 %1, %2
+  %S1 = shl i32 %A1, 3
+  %D1 = udiv i32 %S1, %2
+  br label %J
+
+F:
+  %A2 = add i32 %2, %1
+  %S2 = shl i32 %A2, 3
+  %D2 = udiv i32 %S2, %2
+  %X2 = xor i32 %D2, %1
+  br label %J
+
+J:
+  %P = phi i32 [ %D1, %T ], [ %X2, %F ]
+  %A3 = add i32 %1, %2
+  %R = sub i32 %P, %A3
+  ret i32 %R
+}
+
+; The mul does not change in the loop and moves into the preheader.
+; CHECK-LABEL: i32 @cse16_loop(i32 %0, i32 %1)
+define i32 @cse16_loop(i32 %0, i32 %1) {
+; CHECK-NEXT: E
+; CHECK-NEXT: mul i32 %0, %1
+; CHECK-NEXT: br label %L
+; CHECK: L:
+; CHECK-NOT: mul
+; CHECK: ret i32
+E:
+  br label %L
+
+L:
+  %I = phi i32 [ 0, %E ], [ %N, %L ]
+  %S = phi i32 [ 0, %E ], [ %T, %L ]
+  %M = mul i32 %0, %1
+  %T = add i32 %S, %M
+  %N = add i32 %I, 1
+  %C = icmp slt i32 %N, 10
+  br i1 %C, label %L, label %X
+
+X:
+  ret i32 %T
+}
@@ -0,0 +1,53 @@
+; ModuleID = 'cse17'
+; CHECK-LABEL: source_filename = "cse17"
+source_filename = "cse17"
+
+; With a budget of 24 instructions, @cse17_big runs out of it during DCE
+; and keeps its redundant expressions; the output is still valid.
+; @cse17 fits in the budget and is fully optimized.
+; CHECK-LABEL: i32 @cse17_big(i32 %0, i32 %1)
+define i32 @cse17_big(i32 %0, i32 %1) {
+; CHECK: %A1 = add i32 %0, %1
+; CHECK: %A2 = add i32 %0, %1
+; CHECK: ret i32
+BB:
+  %A1 = add i32 %0, %1
+  %A2 = add i32 %0, %1
+  %M1 = mul i32 %A1, %A2
+  %M2 = mul i32 %A1, %A2
+  %S1 = sub i32 %M1, %0
+  %S2 = sub i32 %M2, %0
+  %X1 = xor i32 %S1, %1
+  %X2 = xor i32 %S2, %1
+  %O1 = or i32 %X1, %A1
+  %O2 = or i32 %X2, %A2
+  %N1 = and i32 %O1, %M1
+  %N2 = and i32 %O2, %M2
+  %B1 = add i32 %N1, %S1
+  %B2 = add i32 %N2, %S2
+  %C1 = mul i32 %B1, %X1
+  %C2 = mul i32 %B2, %X2
+  %D1 = sub i32 %C1, %O1
+  %D2 = sub i32 %C2, %O2
+  %E1 = xor i32 %D1, %N1
+  %E2 = xor i32 %D2, %N2
+  %F1 = or i32 %E1, %B1
+  %F2 = or i32 %E2, %B2
+  %G1 = and i32 %F1, %C1
+  %G2 = and i32 %F2, %C2
+  %R = add i32 %G1, %G2
+  ret i32 %R
+}
+
+; CHECK-LABEL: i32 @cse17(i32 %0, i32 %1)
+define i32 @cse17(i32 %0, i32 %1) {
+; CHECK-NEXT: BB
+; CHECK-NEXT: add i32 %0, %1
+; CHECK-NEXT: add i32 %A1, %A1
+; CHECK-NEXT: ret i32
+BB:
+  %A1 = add i32 %0, %1
+  %A2 = add i32 %0, %1
+  %R = add i32 %A1, %A2
+  ret i32 %R
+}
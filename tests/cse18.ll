@@ -0,0 +1,54 @@
+; ModuleID = 'cse18'
+; CHECK-LABEL: source_filename = "cse18"
+source_filename = "cse18"
+
+; With -parallel -j=2 the functions are optimized on two worker threads and
+; spliced back in order. @cse18_unnamed refers to an unnamed global, cannot
+; be sent back and is optimized by the main thread instead.
+@0 = internal global i32 5
+@cse18_g = global i32 1
+
+; CHECK-LABEL: define internal i32 @cse18_leaf(i32 %a, i32 %b)
+define internal i32 @cse18_leaf(i32 %a, i32 %b) {
+; CHECK: %x = add i32 %a, %b
+; CHECK-NOT: add
+; CHECK: mul i32 %x, %x
+entry:
+  %x = add i32 %a, %b
+  %y = add i32 %a, %b
+  %r = mul i32 %x, %y
+  ret i32 %r
+}
+
+; CHECK-LABEL: define i32 @cse18_unnamed(i32 %a)
+define i32 @cse18_unnamed(i32 %a) {
+; CHECK: load i32, i32* @0
+; CHECK-NOT: load
+; CHECK: ret i32
+entry:
+  %v = load i32, i32* @0
+  %w = load i32, i32* @0
+  %s = add i32 %v, %a
+  %t = add i32 %w, %a
+  %r = sub i32 %s, %t
+  %u = add i32 %r, %s
+  ret i32 %u
+}
+
+; CHECK-LABEL: define i32 @cse18(i32 %a)
+define i32 @cse18(i32 %a) {
+; CHECK: %v = load i32, i32* @cse18_g
+; CHECK-NOT: load
+; CHECK: call i32 @cse18_leaf(i32 %a, i32 %v)
+; CHECK: %d = add i32 %c, %v
+; CHECK-NOT: add
+; CHECK: mul i32 %d, %d
+entry:
+  %v = load i32, i32* @cse18_g
+  %w = load i32, i32* @cse18_g
+  %c = call i32 @cse18_leaf(i32 %a, i32 %v)
+  %d = add i32 %c, %w
+  %e = add i32 %c, %v
+  %r = mul i32 %d, %e
+  ret i32 %r
+}
@@ -0,0 +1,73 @@
+; ModuleID = 'cse19'
+; CHECK-LABEL: source_filename = "cse19"
+source_filename = "cse19"
+
+; With -remarks every change is also written to <output>.opt.yaml, named
+; after its counter, with the debug location of the instruction, its block
+; and what replaced it. Blocks without a name are given by number.
+; REMARK:      Name: CSESimplify
+; REMARK-NEXT: DebugLoc: { File: cse19.c, Line: 5, Column: 3 }
+; REMARK-NEXT: Function: cse19
+; REMARK:      Inst: '%z = or'
+; REMARK:      Block: entry
+; REMARK:      With: '%y = add'
+; REMARK:      Name: CSEDead
+; REMARK-NEXT: DebugLoc: { File: cse19.c, Line: 2, Column: 3 }
+; REMARK:      Inst: '%dead = mul'
+; REMARK:      String: ' erased'
+; REMARK:      Name: CSEElim
+; REMARK-NEXT: DebugLoc: { File: cse19.c, Line: 4, Column: 3 }
+; REMARK:      Inst: '%y = add'
+; REMARK:      With: '%x = add'
+; REMARK:      Name: CSELICM
+; REMARK-NEXT: DebugLoc: { File: cse19.c, Line: 10, Column: 5 }
+; REMARK-NEXT: Function: cse19_loop
+; REMARK:      Inst: '%m = mul'
+; REMARK:      Block: '#1'
+; REMARK:      To: '#0'
+; CHECK-LABEL: i32 @cse19(i32 %a, i32 %b)
+define i32 @cse19(i32 %a, i32 %b) !dbg !6 {
+; CHECK: %x = add i32 %a, %b
+; CHECK-NEXT: %r = mul i32 %x, %x
+; CHECK-NEXT: ret i32 %r
+entry:
+  %dead = mul i32 %a, %b, !dbg !9
+  %x = add i32 %a, %b, !dbg !10
+  %y = add i32 %b, %a, !dbg !11
+  %z = or i32 %y, 0, !dbg !12
+  %r = mul i32 %z, %x
+  ret i32 %r
+}
+
+; CHECK-LABEL: i32 @cse19_loop(i32 %n, i32 %a)
+define i32 @cse19_loop(i32 %n, i32 %a) !dbg !13 {
+; CHECK-NEXT: mul i32 %a, %a
+; CHECK-NEXT: br label
+  br label %1
+
+1:
+  %i = phi i32 [ 0, %0 ], [ %i.next, %1 ]
+  %m = mul i32 %a, %a, !dbg !14
+  %i.next = add i32 %i, %m
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %1, label %2
+
+2:
+  ret i32 %i.next
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, emissionKind: LineTablesOnly)
+!1 = !DIFile(filename: "cse19.c", directory: "/")
+!2 = !DISubroutineType(types: !{})
+!3 = !{i32 2, !"Debug Info Version", i32 3}
+!4 = !{i32 7, !"Dwarf Version", i32 4}
+!6 = distinct !DISubprogram(name: "cse19", scope: !1, file: !1, line: 1, type: !2, unit: !0)
+!9 = !DILocation(line: 2, column: 3, scope: !6)
+!10 = !DILocation(line: 3, column: 3, scope: !6)
+!11 = !DILocation(line: 4, column: 3, scope: !6)
+!12 = !DILocation(line: 5, column: 3, scope: !6)
+!13 = distinct !DISubprogram(name: "cse19_loop", scope: !1, file: !1, line: 8, type: !2, unit: !0)
+!14 = !DILocation(line: 10, column: 5, scope: !13)
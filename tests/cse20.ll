@@ -0,0 +1,28 @@
+; ModuleID = 'cse20'
+; CHECK-LABEL: source_filename = "cse20"
+source_filename = "cse20"
+
+declare void @mayunwind() readnone
+declare void @nounwind() readnone nounwind
+
+; If @mayunwind unwinds, the caller sees the first store to %0, so it is
+; kept. Nothing between the stores to %1 may throw: the first one is dead.
+; CHECK-LABEL: void @cse20(i32* %0, i32* noalias %1)
+define void @cse20(i32* %0, i32* noalias %1) {
+; CHECK-NEXT: BB
+; CHECK-NEXT: store i32 1, i32* %0
+; CHECK-NEXT: call void @mayunwind()
+; CHECK-NEXT: store i32 2, i32* %0
+; CHECK-NEXT: call void @nounwind()
+; CHECK-NEXT: store i32 4, i32* %1
+; CHECK-NEXT: ret void
+
+BB:
+  store i32 1, i32* %0, align 4
+  call void @mayunwind()
+  store i32 2, i32* %0, align 4
+  store i32 3, i32* %1, align 4
+  call void @nounwind()
+  store i32 4, i32* %1, align 4
+  ret void
+}
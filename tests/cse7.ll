@@ -0,0 +1,38 @@
+; ModuleID = 'cse7'
+; CHECK-LABEL: source_filename = "cse7"
+source_filename = "cse7"
+
+; CHECK-LABEL: i32 @cse7(i8* %0, i32* %1, i64* %2, i32 %3, i64 %4, i8 %5)
+define i32 @cse7(i8* %0, i32* %1, i64* %2, i32 %3, i64 %4, i8 %5) {
+; CHECK-NEXT: BB
+; CHECK-NEXT: mul
+; CHECK-NEXT: xor
+; CHECK-NEXT: br label
+BB:
+  %6 = mul i32 %3, %3
+  %7 = xor i32 %6, 77033
+  br label %BB1
+
+; CHECK-LABEL: BB1:
+; CHECK-NEXT: icmp
+; CHECK-NEXT: br i1
+BB1:                                              ; preds = %BB
+  %8 = mul i32 %3, %3
+  %Cmp = icmp sgt i32 %8, %7
+  br i1 %Cmp, label %BB2, label %BB3
+
+; CHECK-LABEL: BB2:
+; CHECK-NEXT: store
+; CHECK-NEXT: br label
+BB2:                                              ; preds = %BB1
+  %9 = mul i32 %3, %3
+  %10 = xor i32 %9, 77033
+  store i32 %10, i32* %1, align 4
+  br label %BB3
+
+; CHECK-LABEL: BB3:
+; CHECK-NEXT: ret i32
+BB3:                                              ; preds = %BB2, %BB1
+  %11 = xor i32 %6, 77033
+  ret i32 %11
+}
@@ -0,0 +1,19 @@
+; ModuleID = 'cse8'
+; CHECK-LABEL: source_filename = "cse8"
+source_filename = "cse8"
+
+; CHECK-LABEL: i32 @cse8(i8* %0, i32* %1, i64* %2, i32 %3, i64 %4, i8 %5)
+define i32 @cse8(i8* %0, i32* %1, i64* %2, i32 %3, i64 %4, i8 %5) {
+; CHECK-NEXT: BB
+; CHECK-NEXT: store i32 %3
+; CHECK-NEXT: ret i32 %3
+BB:
+  %6 = trunc i64 %4 to i32
+  %7 = sdiv i32 %3, %6
+  %8 = sdiv i32 %3, %6
+  %9 = sub i32 %7, %8
+  %10 = add i32 %3, %9
+  %11 = or i32 %10, %9
+  store i32 %11, i32* %1, align 4
+  ret i32 %11
+}
@@ -0,0 +1,18 @@
+; ModuleID = 'cse9'
+; CHECK-LABEL: source_filename = "cse9"
+source_filename = "cse9"
+
+; CHECK-LABEL: i32 @cse9(i8* %0, i32* %1, i64* %2, i32 %3, i64 %4, i8 %5)
+define i32 @cse9(i8* %0, i32* %1, i64* %2, i32 %3, i64 %4, i8 %5) {
+; CHECK-NEXT: BB
+; CHECK-NEXT: ret i32 %3
+BB:
+  %6 = zext i8 %5 to i32
+  %7 = mul i32 %3, %6
+  %8 = sdiv i32 %7, %6
+  %9 = xor i32 %8, %7
+  %10 = icmp slt i32 %9, %8
+  %11 = select i1 %10, i32 %9, i32 %7
+  %12 = shl i32 %11, %6
+  ret i32 %3
+}